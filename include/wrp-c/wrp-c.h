@@ -3,8 +3,12 @@
 #ifndef __WRP_C_H__
 #define __WRP_C_H__
 
+#include <stdbool.h>
 #include <stdint.h>
 
+/* Defined in <sys/uio.h>, only needed by wrp_to_msgpack_iov(). */
+struct iovec;
+
 /*----------------------------------------------------------------------------*/
 /*                                Return Codes                                */
 /*----------------------------------------------------------------------------*/
@@ -26,6 +30,7 @@ typedef enum {
     WRPE_NOT_FROM_WRPC,      /*  7 */
     WRPE_NO_SCHEME,          /*  8 */
     WRPE_NO_AUTHORITY,       /*  9 */
+    WRPE_NOT_JSON_FORMAT,    /* 10 */
 
     WRPE_LAST /* never use! */
 } WRPcode;
@@ -182,6 +187,139 @@ typedef struct {
 } wrp_msg_t;
 // clang-format on
 
+/* The fields of a message.  These are used to build masks of the fields to
+ * decode, ie: WRP_FIELD_BIT(WRP_FIELD__PAYLOAD). */
+// clang-format off
+enum wrp_field {
+    WRP_FIELD__ACCEPT = 0,
+    WRP_FIELD__CONTENT_TYPE,
+    WRP_FIELD__DEST,
+    WRP_FIELD__HEADERS,
+    WRP_FIELD__METADATA,
+    WRP_FIELD__MSG_ID,
+    WRP_FIELD__MSG_TYPE,
+    WRP_FIELD__PARTNER_IDS,
+    WRP_FIELD__PATH,
+    WRP_FIELD__PAYLOAD,
+    WRP_FIELD__RDR,
+    WRP_FIELD__SESSION_ID,
+    WRP_FIELD__SERVICE_NAME,
+    WRP_FIELD__SOURCE,
+    WRP_FIELD__STATUS,
+    WRP_FIELD__TRANS_ID,
+    WRP_FIELD__URL,
+
+    WRP_FIELD__LAST /* never use! */
+};
+// clang-format on
+
+#define WRP_FIELD_BIT(field) (UINT32_C(1) << (field))
+#define WRP_FIELDS_ALL       (WRP_FIELD_BIT(WRP_FIELD__LAST) - 1)
+
+/* Options that may be added to a mask of fields to decode. */
+#define WRP_INDEX_METADATA (UINT32_C(1) << 31) /* Index the metadata by name. */
+#define WRP_INDEX_HEADERS  (UINT32_C(1) << 30) /* Split and index the headers. */
+
+/* The fields needed to route a message. */
+typedef struct {
+    enum wrp_msg_type msg_type;
+    struct wrp_string source;
+    struct wrp_string dest;
+    struct wrp_string trans_id;
+} wrp_peek_t;
+
+/* An opaque, reusable decoder. */
+typedef struct wrp_decoder wrp_decoder_t;
+
+/* An opaque decoder for a stream of concatenated messages. */
+typedef struct wrp_stream wrp_stream_t;
+
+/* An opaque, memory mapped capture file of concatenated messages. */
+typedef struct wrp_capture wrp_capture_t;
+
+/* How the messages from wrp_to_msgpack_batch() are framed. */
+enum wrp_framing {
+    WRP_FRAMING__NONE,  /* The messages are simply back to back. */
+    WRP_FRAMING__LEN32, /* Each message follows its 4 byte big endian length. */
+};
+
+/* How wrp_to_json() writes the payload and wrp_from_json() reads it. */
+enum wrp_json_payload {
+    WRP_JSON_PAYLOAD__OMIT,   /* The payload is left out. */
+    WRP_JSON_PAYLOAD__BASE64, /* The payload is a base64 string. */
+    WRP_JSON_PAYLOAD__UTF8,   /* The payload is a string if it is valid UTF-8,
+                               * otherwise it is left out. */
+};
+
+/* An opaque message encoding with the invariant fields encoded ahead of time. */
+typedef struct wrp_template wrp_template_t;
+
+/**
+ *  Called with each message found in a stream.
+ *
+ *  @param ctx the context passed to wrp_stream_create()
+ *  @param rv  the result of decoding the message
+ *  @param msg the message if rv is WRPE_OK, NULL otherwise.  The message is
+ *             only valid until the callback returns.
+ */
+typedef void (*wrp_stream_fn)(void *ctx, WRPcode rv, wrp_msg_t *msg);
+
+/**
+ *  Called with each chunk of an encoded message, in order.
+ *
+ *  @param ctx  the context passed to wrp_to_msgpack_flush() or wrp_to_json_flush()
+ *  @param data the next bytes of the encoding
+ *  @param len  the length of data
+ *
+ *  @return WRPE_OK to continue, any other value stops the encoding and is
+ *          returned by the caller
+ */
+typedef WRPcode (*wrp_flush_fn)(void *ctx, const void *data, size_t len);
+
+/* The levels of wrp_log_msg(), from the least to the most verbose. */
+enum wrp_log_level {
+    WRP_LOG_LEVEL__ERROR,
+    WRP_LOG_LEVEL__WARNING,
+    WRP_LOG_LEVEL__INFO,
+    WRP_LOG_LEVEL__DEBUG,
+    WRP_LOG_LEVEL__TRACE,
+};
+
+/**
+ *  Decides if a message is logged, once it has passed the level check.
+ *
+ *  @param ctx   the ctx of the struct wrp_log
+ *  @param level the level the message is logged at
+ *  @param msg   the message to log
+ *
+ *  @return true to format and log the message, false to drop it
+ */
+typedef bool (*wrp_log_filter_fn)(void *ctx, enum wrp_log_level level,
+                                  const wrp_msg_t *msg);
+
+/**
+ *  Called with each formatted message.
+ *
+ *  @param ctx   the ctx of the struct wrp_log
+ *  @param level the level the message is logged at
+ *  @param text  the message as wrp_to_string() formats it, '\0' terminated.
+ *               The text is only valid until the callback returns.
+ *  @param len   the length of text, not counting the '\0'
+ */
+typedef void (*wrp_log_fn)(void *ctx, enum wrp_log_level level, const char *text,
+                           size_t len);
+
+/* Where messages are logged, and which ones. */
+struct wrp_log {
+    enum wrp_log_level level; /* The most verbose level that is logged. */
+    wrp_log_filter_fn filter; /* Optional, checked after the level.    */
+    wrp_log_fn fn;            /* Where the formatted messages go.      */
+    void *ctx;                /* Passed to filter and fn.              */
+};
+
+/* The most iovecs wrp_to_msgpack_iov() produces. */
+#define WRP_IOV_MAX 3
+
 /*----------------------------------------------------------------------------*/
 /*                              WRP Functions                                 */
 /*----------------------------------------------------------------------------*/
@@ -208,14 +346,331 @@ typedef struct {
 WRPcode wrp_from_msgpack(const void *src, size_t len, wrp_msg_t **dest);
 
 
+/**
+ *  Same as wrp_from_msgpack() except only the optional fields in the mask are
+ *  decoded.  The optional fields that are not in the mask are left empty.
+ *  Required fields, including the payload of a request, are always decoded.
+ *
+ *  @param src    the buffer with the msgpack data
+ *  @param len    the length of the src buffer
+ *  @param fields the mask of the optional fields to decode, built from
+ *                WRP_FIELD_BIT() or WRP_FIELDS_ALL, plus any WRP_INDEX_*
+ *                options
+ *  @param dest   the resulting object (must be released)
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_NOT_MSGPACK_FORMAT
+ *  @retval WRPE_NOT_A_WRP_MSG
+ *  @retval WRPE_MSG_TOO_BIG
+ *  @retval WRPE_OUT_OF_MEMORY
+ *  @retval WRPE_OTHER_ERROR
+ */
+WRPcode wrp_from_msgpack_ex(const void *src, size_t len, uint32_t fields,
+                            wrp_msg_t **dest);
+
+
+/**
+ *  Same as wrp_from_msgpack() except the buffer is read sequentially and the
+ *  c structure is filled in directly, without building a msgpack node tree
+ *  first.  The message and its lists are placed in a single allocation.
+ *
+ *  @note The resulting message structure references the original data.
+ *        The user should call wrp_destroy() on the returned msg before
+ *        releaseing the original data object.
+ *
+ *  @param src  the buffer with the msgpack data
+ *  @param len  the length of the src buffer
+ *  @param dest the resulting object (must be released)
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_NOT_MSGPACK_FORMAT
+ *  @retval WRPE_NOT_A_WRP_MSG
+ *  @retval WRPE_MSG_TOO_BIG
+ *  @retval WRPE_OUT_OF_MEMORY
+ *  @retval WRPE_OTHER_ERROR
+ */
+WRPcode wrp_from_msgpack_reader(const void *src, size_t len, wrp_msg_t **dest);
+
+
+/**
+ *  Same as wrp_from_msgpack_reader() except the message and its lists are
+ *  placed in the caller supplied arena, so no memory is allocated.
+ *
+ *  @note The resulting message structure references both the original data
+ *        and the arena.  Calling wrp_destroy() on the message is allowed, but
+ *        does nothing; the message is gone once the arena is reused.
+ *
+ *  @param src       the buffer with the msgpack data
+ *  @param len       the length of the src buffer
+ *  @param arena     the memory to place the message in
+ *  @param arena_len the length of the arena
+ *  @param dest      the resulting object
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_NOT_MSGPACK_FORMAT
+ *  @retval WRPE_NOT_A_WRP_MSG
+ *  @retval WRPE_MSG_TOO_BIG (including when the arena is too small)
+ *  @retval WRPE_OTHER_ERROR
+ */
+WRPcode wrp_from_msgpack_arena(const void *src, size_t len, void *arena,
+                               size_t arena_len, wrp_msg_t **dest);
+
+
+/**
+ *  Converts a batch of buffers with msgpack encoded wrps into c structures.
+ *  The messages and their lists are all placed in a single allocation.
+ *
+ *  @note The resulting messages reference the original data.  Release the
+ *        whole batch with wrp_destroy_batch(); calling wrp_destroy() on a
+ *        message from a batch is allowed, but does nothing.
+ *
+ *  @param srcs    the buffers with the msgpack data
+ *  @param lens    the lengths of the buffers
+ *  @param count   the number of buffers
+ *  @param threads the number of threads to decode with, 0 or 1 means only
+ *                 the calling thread is used
+ *  @param dests   the resulting array of count messages (must be released,
+ *                 even if an error is returned).  A message that could not
+ *                 be decoded is NULL.
+ *
+ *  @retval WRPE_OK                 every message was decoded
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_OUT_OF_MEMORY      nothing was decoded
+ *  @retval the error of the first message that could not be decoded
+ */
+WRPcode wrp_from_msgpack_batch(const void *const *srcs, const size_t *lens,
+                               size_t count, size_t threads, wrp_msg_t ***dests);
+
+
+/**
+ *  Releases a batch of messages from wrp_from_msgpack_batch().
+ *
+ *  @param msgs the array of messages to release
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_NOT_FROM_WRPC
+ */
+WRPcode wrp_destroy_batch(wrp_msg_t **msgs);
+
+
+/**
+ *  Creates a decoder for a stream of concatenated msgpack encoded wrps that
+ *  arrive in arbitrary pieces, like the reads from a socket.
+ *
+ *  @param stream  the resulting stream decoder
+ *  @param max_len the largest message allowed, in bytes
+ *  @param fn      the function called with each message
+ *  @param ctx     the context passed to fn
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_OUT_OF_MEMORY
+ */
+WRPcode wrp_stream_create(wrp_stream_t **stream, size_t max_len,
+                          wrp_stream_fn fn, void *ctx);
+
+
+/**
+ *  Feeds the next bytes of the stream to the decoder.  Each message that is
+ *  completed is passed to the callback before this returns.  Messages that
+ *  are entirely in data are decoded in place, only a message split across
+ *  calls is copied.
+ *
+ *  @note If an error is returned the partial message and the rest of data
+ *        are dropped.  The stream is likely out of sync at that point.
+ *
+ *  @param stream the stream decoder
+ *  @param data   the next bytes of the stream
+ *  @param len    the length of data
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_NOT_MSGPACK_FORMAT
+ *  @retval WRPE_MSG_TOO_BIG
+ *  @retval WRPE_OUT_OF_MEMORY
+ */
+WRPcode wrp_stream_feed(wrp_stream_t *stream, const void *data, size_t len);
+
+
+/**
+ *  Releases the stream decoder, dropping any partial message.
+ *
+ *  @param stream the stream decoder to destroy
+ */
+void wrp_stream_destroy(wrp_stream_t *stream);
+
+
+/**
+ *  Opens a capture file of concatenated msgpack encoded wrps.  The file is
+ *  memory mapped and the start of each record is indexed in a single pass,
+ *  nothing is decoded or copied.
+ *
+ *  @note A partial record at the end of the file is not included.
+ *
+ *  @param capture the resulting capture
+ *  @param path    the file to open
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_NOT_MSGPACK_FORMAT
+ *  @retval WRPE_OUT_OF_MEMORY
+ *  @retval WRPE_OTHER_ERROR (the file could not be opened or mapped)
+ */
+WRPcode wrp_capture_open(wrp_capture_t **capture, const char *path);
+
+
+/**
+ *  Returns the number of records in the capture.
+ *
+ *  @param capture the capture
+ */
+size_t wrp_capture_count(const wrp_capture_t *capture);
+
+
+/**
+ *  Gets the raw bytes of a record from the capture.
+ *
+ *  @param capture the capture
+ *  @param index   the index of the record
+ *  @param data    the resulting record, which points into the capture
+ *  @param len     the length of the record
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ */
+WRPcode wrp_capture_record(const wrp_capture_t *capture, size_t index,
+                           const void **data, size_t *len);
+
+
+/**
+ *  Decodes a record from the capture, the same as wrp_from_msgpack().
+ *
+ *  @note The resulting message references the capture, so it must be released
+ *        before the capture is closed.
+ *
+ *  @param capture the capture
+ *  @param index   the index of the record
+ *  @param dest    the resulting object (must be released)
+ *
+ *  @retval the same values as wrp_from_msgpack()
+ */
+WRPcode wrp_capture_get(const wrp_capture_t *capture, size_t index, wrp_msg_t **dest);
+
+
+/**
+ *  Closes the capture and unmaps the file.
+ *
+ *  @param capture the capture to close
+ */
+void wrp_capture_close(wrp_capture_t *capture);
+
+
+/**
+ *  Extracts only the fields needed to route a message from a buffer with a
+ *  msgpack encoded wrp.  Nothing is allocated and the other fields are
+ *  skipped over without being decoded.
+ *
+ *  @note The resulting strings reference the original data.  The fields that
+ *        don't exist for the message type are left empty.  Only the routing
+ *        fields are validated, so a successful peek does not mean the whole
+ *        message will decode.
+ *
+ *  @param src  the buffer with the msgpack data
+ *  @param len  the length of the src buffer
+ *  @param dest the resulting routing fields
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_NOT_MSGPACK_FORMAT
+ *  @retval WRPE_NOT_A_WRP_MSG
+ *  @retval WRPE_OTHER_ERROR
+ */
+WRPcode wrp_peek(const void *src, size_t len, wrp_peek_t *dest);
+
+
+/**
+ *  Creates a reusable decoder.  The decoder keeps the buffers it needs to
+ *  decode a message and grows them as needed, so decoding a stream of
+ *  messages does not allocate once the buffers are large enough.
+ *
+ *  @note A decoder is not thread safe.  Use one decoder per thread.
+ *
+ *  @param dec the resulting decoder
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_OUT_OF_MEMORY
+ */
+WRPcode wrp_decoder_create(wrp_decoder_t **dec);
+
+
+/**
+ *  Converts a message pack encoded form into a message that is owned by the
+ *  decoder.
+ *
+ *  @note The resulting message structure references both the original data
+ *        and the decoder.  It is valid until the next call to any of the
+ *        decoder functions.  Calling wrp_destroy() on the message is allowed,
+ *        but does nothing.
+ *
+ *  @param dec  the decoder to use
+ *  @param src  the buffer with the msgpack data
+ *  @param len  the length of the src buffer
+ *  @param dest the resulting object
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_NOT_MSGPACK_FORMAT
+ *  @retval WRPE_NOT_A_WRP_MSG
+ *  @retval WRPE_MSG_TOO_BIG
+ *  @retval WRPE_OUT_OF_MEMORY
+ *  @retval WRPE_OTHER_ERROR
+ */
+WRPcode wrp_decoder_decode(wrp_decoder_t *dec, const void *src, size_t len,
+                           wrp_msg_t **dest);
+
+
+/**
+ *  Releases the buffers held by the decoder so it starts over from scratch.
+ *  Any message from the decoder is no longer valid.
+ *
+ *  @param dec the decoder to reset
+ */
+void wrp_decoder_reset(wrp_decoder_t *dec);
+
+
+/**
+ *  Releases the decoder and all of its buffers.  Any message from the decoder
+ *  is no longer valid.
+ *
+ *  @param dec the decoder to destroy
+ */
+void wrp_decoder_destroy(wrp_decoder_t *dec);
+
+
+/**
+ *  Computes the exact number of bytes wrp_to_msgpack() produces for the
+ *  message, so a buffer of exactly the right size can be provided.
+ *
+ *  @param msg the message to size
+ *
+ *  @return the encoded length, or 0 if the message is not a valid wrp message
+ */
+size_t wrp_msgpack_size(const wrp_msg_t *msg);
+
+
 /**
  *  Converts a wrp structure to a message pack encoded form, either in a user
  *  specified buffer or one allocated by the function.
  *
  *  @param src  the message to encode
  *  @param dest If *dest != NULL then encode into the specified buffer.
- *              If *dest == NULL then the function will allocate a buffer and
- *              return a pointer to it here.
+ *              If *dest == NULL then the function will allocate a buffer of
+ *              exactly wrp_msgpack_size() bytes and return a pointer to it
+ *              here.
  *  @param len  The dest buffer length if provided, and the number of valid
  *              encoded byte in dest.
  *
@@ -230,7 +685,237 @@ WRPcode wrp_to_msgpack(const wrp_msg_t *src, uint8_t **dest, size_t *len);
 
 
 /**
- *  Cleans up the allocations from the msg.
+ *  Converts a wrp structure to a canonical message pack encoded form, so
+ *  messages with the same content always encode to the same bytes and the
+ *  encoding can be hashed or compared directly.  The keys are in a fixed
+ *  order, integers and lengths use their smallest encodings and the metadata
+ *  is sorted by name, then by value.  The other lists keep their order since
+ *  it has meaning.
+ *
+ *  @param src  the message to encode
+ *  @param dest the output buffer, which behaves the same as it does for
+ *              wrp_to_msgpack()
+ *  @param len  the dest buffer length if provided, and the number of valid
+ *              encoded bytes in dest
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_NOT_A_WRP_MSG
+ *  @retval WRPE_MSG_TOO_BIG
+ *  @retval WRPE_OUT_OF_MEMORY
+ */
+WRPcode wrp_to_msgpack_canonical(const wrp_msg_t *src, uint8_t **dest, size_t *len);
+
+
+/**
+ *  Converts a wrp structure to a message pack encoded form without copying
+ *  the payload.  Everything except the payload is encoded into dest, and the
+ *  iovecs describe the full encoding in order, with the payload iovec
+ *  pointing at the payload of src.  The iovecs can be passed to writev() or
+ *  sendmsg() as long as both dest and the payload are valid.
+ *
+ *  @param src    the message to encode
+ *  @param dest   the buffer for everything but the payload, which behaves the
+ *                same as it does for wrp_to_msgpack()
+ *  @param len    the dest buffer length if provided, and the number of valid
+ *                encoded bytes in dest
+ *  @param iov    the resulting iovecs, an array of at least WRP_IOV_MAX
+ *  @param iovcnt the resulting number of iovecs used
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_NOT_A_WRP_MSG
+ *  @retval WRPE_MSG_TOO_BIG
+ *  @retval WRPE_OUT_OF_MEMORY
+ *  @retval WRPE_OTHER_ERROR
+ */
+WRPcode wrp_to_msgpack_iov(const wrp_msg_t *src, uint8_t **dest, size_t *len,
+                           struct iovec *iov, int *iovcnt);
+
+
+/**
+ *  Converts a wrp structure to a message pack encoded form, passing it to the
+ *  callback in chunks instead of building the whole encoding in memory.  The
+ *  small writes are staged in buf; larger ones, like the payload, are passed
+ *  to the callback directly.
+ *
+ *  @param src the message to encode
+ *  @param buf the staging buffer
+ *  @param len the length of the staging buffer, which must be at least 32
+ *  @param fn  the callback for each chunk
+ *  @param ctx the context passed to the callback
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_NOT_A_WRP_MSG
+ *  @retval WRPE_OTHER_ERROR
+ *  @retval any value returned by the callback
+ */
+WRPcode wrp_to_msgpack_flush(const wrp_msg_t *src, void *buf, size_t len,
+                             wrp_flush_fn fn, void *ctx);
+
+
+/**
+ *  Converts an array of wrp structures into one buffer of message pack
+ *  encoded messages, in order.  The whole batch is sized first so the buffer
+ *  is only allocated once.
+ *
+ *  @param msgs    the messages to encode
+ *  @param count   the number of messages
+ *  @param framing how each message is framed in the buffer
+ *  @param dest    the output buffer, which behaves the same as it does for
+ *                 wrp_to_msgpack()
+ *  @param len     the dest buffer length if provided, and the number of valid
+ *                 encoded bytes in dest
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_NOT_A_WRP_MSG
+ *  @retval WRPE_MSG_TOO_BIG
+ *  @retval WRPE_OUT_OF_MEMORY
+ */
+WRPcode wrp_to_msgpack_batch(const wrp_msg_t *const *msgs, size_t count,
+                             enum wrp_framing framing, uint8_t **dest, size_t *len);
+
+
+/**
+ *  Replaces the value of a string field (like dest or source) in a msgpack
+ *  encoded wrp without decoding and encoding the message again.  Everything
+ *  else is copied as is.
+ *
+ *  @note When *dest is src the field is rewritten in place, and only the
+ *        bytes after the field move when the length changes.
+ *
+ *  @param src       the msgpack encoded wrp
+ *  @param len       the length of src
+ *  @param field     the string field to replace
+ *  @param value     the new value (does not need to be '\0' terminated), which
+ *                   may not overlap the output
+ *  @param value_len the length of the new value
+ *  @param dest      If *dest != NULL then write into the specified buffer.
+ *                   If *dest == NULL then the function will allocate a buffer
+ *                   and return a pointer to it here.
+ *  @param dest_len  The dest buffer length if provided, and the number of
+ *                   valid encoded bytes in dest.
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_NOT_MSGPACK_FORMAT
+ *  @retval WRPE_NOT_A_WRP_MSG      the field is missing or isn't a string
+ *  @retval WRPE_MSG_TOO_BIG
+ *  @retval WRPE_OUT_OF_MEMORY
+ */
+WRPcode wrp_rewrite_field(const void *src, size_t len, enum wrp_field field,
+                          const char *value, size_t value_len, uint8_t **dest,
+                          size_t *dest_len);
+
+
+/**
+ *  Creates a template from a prototype message.  All fields not in vary are
+ *  encoded once from the prototype; only the fields in vary are encoded for
+ *  each message.
+ *
+ *  @param tmpl  the resulting template
+ *  @param proto the message with the invariant fields, which is not needed
+ *               after this call
+ *  @param vary  the fields that change per message, made of WRP_FIELD_BIT()
+ *               values.  The msg_type may not vary.
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_NOT_A_WRP_MSG
+ *  @retval WRPE_OUT_OF_MEMORY
+ */
+WRPcode wrp_template_create(wrp_template_t **tmpl, const wrp_msg_t *proto,
+                            uint32_t vary);
+
+
+/**
+ *  Encodes a message from the template.  Only the varying fields of msg are
+ *  used, the rest come from the prototype, and the result is the same as
+ *  wrp_to_msgpack() of the prototype with the varying fields of msg.
+ *
+ *  @param tmpl the template to use
+ *  @param src  the message with the varying fields, which must have the same
+ *              msg_type as the prototype
+ *  @param dest the output buffer, which behaves the same as it does for
+ *              wrp_to_msgpack()
+ *  @param len  the dest buffer length if provided, and the number of valid
+ *              encoded bytes in dest
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_MSG_TOO_BIG
+ *  @retval WRPE_OUT_OF_MEMORY
+ */
+WRPcode wrp_template_encode(const wrp_template_t *tmpl, const wrp_msg_t *src,
+                            uint8_t **dest, size_t *len);
+
+
+/**
+ *  Releases the template.
+ *
+ *  @param tmpl the template to destroy
+ */
+void wrp_template_destroy(wrp_template_t *tmpl);
+
+
+/**
+ *  Finds the value of a metadata entry by name.  Messages decoded with the
+ *  WRP_INDEX_METADATA option are looked up in constant time, all others are
+ *  searched in order.
+ *
+ *  @param msg  the message to search
+ *  @param name the name to find (does not need to be '\0' terminated)
+ *  @param len  the length of the name
+ *
+ *  @return the value of the first entry with the name, or NULL if there is
+ *          none or the message type has no metadata
+ */
+const struct wrp_string *wrp_metadata_get(const wrp_msg_t *msg, const char *name,
+                                          size_t len);
+
+
+/**
+ *  Finds the value of a header by name, ignoring the case of the name.  The
+ *  headers are "Name: value" strings; the value found has the whitespace
+ *  around it removed.  Messages decoded with the WRP_INDEX_HEADERS option
+ *  have their headers split once and are looked up in constant time, all
+ *  others are split and searched in order.
+ *
+ *  @param msg   the message to search
+ *  @param name  the name to find (does not need to be '\0' terminated)
+ *  @param len   the length of the name
+ *  @param value the resulting value, which points into the header
+ *
+ *  @return true if the header was found, false otherwise
+ */
+bool wrp_header_get(const wrp_msg_t *msg, const char *name, size_t len,
+                    struct wrp_string *value);
+
+
+/**
+ *  Copies a message into a single allocation that holds everything the message
+ *  references: the lists, the strings and the payload.  The clone references
+ *  nothing outside of itself, so the original and its data can be released
+ *  right away.
+ *
+ *  @note The original field of the clone is left empty.
+ *
+ *  @param src  the message to copy, it does not need to be from wrp-c
+ *  @param dest the resulting clone (must be released with wrp_destroy())
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_OUT_OF_MEMORY
+ *  @retval WRPE_NOT_A_WRP_MSG
+ */
+WRPcode wrp_msg_compact_clone(const wrp_msg_t *src, wrp_msg_t **dest);
+
+
+/**
+ *  Cleans up the allocations from the msg.  Messages placed in caller owned
+ *  memory have nothing to clean up, so this does nothing for them.
  *
  *  @retval WRPE_OK
  *  @retval WRPE_NOT_FROM_WRPC
@@ -252,6 +937,128 @@ WRPcode wrp_destroy(wrp_msg_t *msg);
 WRPcode wrp_to_string(const wrp_msg_t *msg, char **dst, size_t *len);
 
 
+/**
+ *  Prints a wrp_msg_t structure into a caller provided buffer, the same way
+ *  wrp_to_string() does, without allocating.  Like snprintf(), as much as
+ *  fits is written, the output is always '\0' terminated when size is not 0,
+ *  and the full length is returned either way.
+ *
+ *  @param msg  the message to convert
+ *  @param buf  the buffer to write into (may be NULL when size is 0)
+ *  @param size the size of the buffer, including room for the '\0'
+ *  @param len  the length of the full output, not counting the '\0'
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_NOT_A_WRP_MSG
+ *  @retval WRPE_MSG_TOO_BIG   the output was cut short
+ */
+WRPcode wrp_to_string_buf(const wrp_msg_t *msg, char *buf, size_t size, size_t *len);
+
+
+/**
+ *  Converts a wrp_msg_t structure into compact JSON in a caller provided
+ *  buffer.  The keys are the same as in the msgpack encoding, msg_type is a
+ *  number, and the strings are escaped as JSON requires with each byte that
+ *  isn't part of valid UTF-8 replaced by \ufffd.  Like snprintf(), as
+ *  much as fits is written, the output is always '\0' terminated when size is
+ *  not 0, and the full length is returned either way.
+ *
+ *  @param msg     the message to convert
+ *  @param payload how to write the payload
+ *  @param buf     the buffer to write into (may be NULL when size is 0)
+ *  @param size    the size of the buffer, including room for the '\0'
+ *  @param len     the length of the full output, not counting the '\0'
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_NOT_A_WRP_MSG
+ *  @retval WRPE_MSG_TOO_BIG   the output was cut short
+ */
+WRPcode wrp_to_json(const wrp_msg_t *msg, enum wrp_json_payload payload, char *buf,
+                    size_t size, size_t *len);
+
+
+/**
+ *  Converts a wrp_msg_t structure into the same JSON as wrp_to_json(),
+ *  staging it in the caller's buffer and passing it to fn each time the
+ *  buffer fills, so output of any size is produced without allocating.  The
+ *  output is not '\0' terminated.
+ *
+ *  @param msg     the message to convert
+ *  @param payload how to write the payload
+ *  @param buf     the staging buffer (at least 32 bytes)
+ *  @param size    the size of the staging buffer
+ *  @param fn      the function called with each chunk, in order
+ *  @param ctx     the context passed to fn
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_NOT_A_WRP_MSG
+ *  @retval any other value returned by fn
+ */
+WRPcode wrp_to_json_flush(const wrp_msg_t *msg, enum wrp_json_payload payload,
+                          void *buf, size_t size, wrp_flush_fn fn, void *ctx);
+
+
+/**
+ *  Parses JSON in the form wrp_to_json() produces into a wrp_msg_t structure.
+ *  Unknown keys are ignored, and null is the same as a missing value.  Unlike
+ *  wrp_from_msgpack() the strings are unescaped, so the message and
+ *  everything it references are placed in a single allocation and nothing
+ *  points into src.
+ *
+ *  @param src     the JSON to parse (does not need to be '\0' terminated)
+ *  @param len     the length of src
+ *  @param payload how the payload is written; WRP_JSON_PAYLOAD__UTF8 takes the
+ *                 string as is and WRP_JSON_PAYLOAD__OMIT ignores it
+ *  @param dest    the resulting message (must be released with wrp_destroy())
+ *
+ *  @retval WRPE_OK
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_OUT_OF_MEMORY
+ *  @retval WRPE_NOT_JSON_FORMAT the text is not valid JSON
+ *  @retval WRPE_NOT_A_WRP_MSG
+ */
+WRPcode wrp_from_json(const char *src, size_t len, enum wrp_json_payload payload,
+                      wrp_msg_t **dest);
+
+
+/*----------------------------------------------------------------------------*/
+/*                             Logging Functions                              */
+/*----------------------------------------------------------------------------*/
+
+/**
+ *  Returns if messages at the level are logged, so callers can skip work
+ *  that is only needed for logging.
+ *
+ *  @param log   the logging setup (may be NULL, which logs nothing)
+ *  @param level the level to check
+ *
+ *  @return true if the level is logged, false otherwise
+ */
+bool wrp_log_enabled(const struct wrp_log *log, enum wrp_log_level level);
+
+
+/**
+ *  Logs a message, formatting it only if the level is logged and the filter,
+ *  if there is one, accepts it.  The message is formatted into a buffer that
+ *  belongs to the calling thread and is reused, so nothing is allocated once
+ *  the buffer is big enough.
+ *
+ *  @param log   the logging setup (may be NULL, which logs nothing)
+ *  @param level the level to log the message at
+ *  @param msg   the message to log
+ *
+ *  @retval WRPE_OK             including when the message is not logged
+ *  @retval WRPE_INVALID_ARGS
+ *  @retval WRPE_OUT_OF_MEMORY
+ *  @retval WRPE_NOT_A_WRP_MSG
+ */
+WRPcode wrp_log_msg(const struct wrp_log *log, enum wrp_log_level level,
+                    const wrp_msg_t *msg);
+
+
 /*----------------------------------------------------------------------------*/
 /*                             Locator Functions                              */
 /*----------------------------------------------------------------------------*/
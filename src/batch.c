@@ -0,0 +1,311 @@
+/* SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "wrp-c.h"
+
+/*----------------------------------------------------------------------------*/
+/*                                   Macros                                   */
+/*----------------------------------------------------------------------------*/
+#define BATCH_SIGNATURE 0x777262
+#define MAX_THREADS     64
+
+/*----------------------------------------------------------------------------*/
+/*                               Data Structures                              */
+/*----------------------------------------------------------------------------*/
+
+/* The single allocation for a batch: the array of messages handed to the
+ * caller followed by the storage for each message. */
+struct batch {
+    int sig;
+    size_t count;
+    wrp_msg_t *msgs[];
+};
+
+struct slot {
+    size_t offset;
+    size_t size;
+    WRPcode rv;
+};
+
+enum pass {
+    PASS__SIZE,
+    PASS__PLACE,
+};
+
+struct job {
+    enum pass pass;
+    const void *const *srcs;
+    const size_t *lens;
+    struct slot *slots;
+    struct batch *b;
+    size_t begin;
+    size_t end;
+};
+
+/* The workers are started once per batch and run both passes, handed each
+ * one under the lock. */
+struct pool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned gen; /* Bumped to start each pass.     */
+    size_t busy;  /* The workers still on the pass. */
+    bool quit;
+
+    struct job job; /* The pass, before it is split. */
+    size_t count;
+    size_t threads;
+};
+
+struct worker {
+    struct pool *pool;
+    size_t t;
+    pthread_t tid;
+    bool started;
+};
+
+/*----------------------------------------------------------------------------*/
+/*                             Internal functions                             */
+/*----------------------------------------------------------------------------*/
+static void run_job(const struct job *job)
+{
+    for (size_t i = job->begin; i < job->end; i++) {
+        struct slot *slot = &job->slots[i];
+
+        if (PASS__SIZE == job->pass) {
+            slot->size = reader_msg_size(job->srcs[i], job->lens[i], &slot->rv);
+        } else if (slot->size) {
+            struct wrp_internal *p;
+
+            p        = (struct wrp_internal *) (((uint8_t *) job->b) + slot->offset);
+            slot->rv = reader_place_msg(job->srcs[i], job->lens[i], p);
+            if (WRPE_OK == slot->rv) {
+                job->b->msgs[i] = &p->msg;
+            }
+        }
+    }
+}
+
+
+/* Runs thread t's even share of the current pass. */
+static void run_share(struct pool *pool, size_t t)
+{
+    size_t per = (pool->count + pool->threads - 1) / pool->threads;
+    struct job job;
+
+    job       = pool->job;
+    job.begin = (pool->count < t * per) ? pool->count : t * per;
+    job.end   = (pool->count < (t + 1) * per) ? pool->count : (t + 1) * per;
+
+    run_job(&job);
+}
+
+
+static void *worker_main(void *arg)
+{
+    struct worker *w  = (struct worker *) arg;
+    struct pool *pool = w->pool;
+    unsigned seen     = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->quit && (seen == pool->gen)) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        if (pool->quit) {
+            break;
+        }
+        seen = pool->gen;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_share(pool, w->t);
+
+        pthread_mutex_lock(&pool->lock);
+        if (0 == --pool->busy) {
+            pthread_cond_broadcast(&pool->cond);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+
+/* Runs a pass across the threads, the calling thread included.  The share of
+ * any worker that couldn't be started is done by the calling thread. */
+static void run_pass(struct pool *pool, struct worker *workers, enum pass pass,
+                     struct batch *b)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->job.pass = pass;
+    pool->job.b    = b;
+    pool->busy     = 0;
+    for (size_t t = 1; t < pool->threads; t++) {
+        if (workers[t].started) {
+            pool->busy++;
+        }
+    }
+    pool->gen++;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_share(pool, 0);
+    for (size_t t = 1; t < pool->threads; t++) {
+        if (!workers[t].started) {
+            run_share(pool, t);
+        }
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy) {
+        pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+static void start_workers(struct pool *pool, struct worker *workers)
+{
+    for (size_t t = 1; t < pool->threads; t++) {
+        workers[t].pool    = pool;
+        workers[t].t       = t;
+        workers[t].started = (0 == pthread_create(&workers[t].tid, NULL, worker_main,
+                                                  &workers[t]));
+    }
+}
+
+
+static void stop_workers(struct pool *pool, struct worker *workers)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t t = 1; t < pool->threads; t++) {
+        if (workers[t].started) {
+            pthread_join(workers[t].tid, NULL);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+WRPcode wrp_from_msgpack_batch(const void *const *srcs, const size_t *lens,
+                               size_t count, size_t threads, wrp_msg_t ***dests)
+{
+    const size_t align = ALIGNMENT_OF(struct wrp_internal);
+    struct worker workers[MAX_THREADS];
+    struct slot *slots = NULL;
+    struct batch *b    = NULL;
+    struct pool pool;
+    size_t size;
+    WRPcode rv = WRPE_OK;
+
+    if (!srcs || !lens || !count || !dests) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (!srcs[i] || !lens[i]) {
+            return WRPE_INVALID_ARGS;
+        }
+    }
+
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (MAX_THREADS < threads) {
+        threads = MAX_THREADS;
+    }
+    if (count < threads) {
+        threads = count;
+    }
+
+    slots = calloc(count, sizeof(struct slot));
+    if (!slots) {
+        return WRPE_OUT_OF_MEMORY;
+    }
+
+    memset(&pool, 0, sizeof(pool));
+    memset(workers, 0, sizeof(workers));
+    pool.job.srcs  = srcs;
+    pool.job.lens  = lens;
+    pool.job.slots = slots;
+    pool.count     = count;
+    pool.threads   = threads;
+
+    if (0 != pthread_mutex_init(&pool.lock, NULL)) {
+        free(slots);
+        return WRPE_OUT_OF_MEMORY;
+    }
+    if (0 != pthread_cond_init(&pool.cond, NULL)) {
+        pthread_mutex_destroy(&pool.lock);
+        free(slots);
+        return WRPE_OUT_OF_MEMORY;
+    }
+    start_workers(&pool, workers);
+
+    /* Pass 1: find out how much storage each message needs. */
+    run_pass(&pool, workers, PASS__SIZE, NULL);
+
+    size = ALIGN_UP(offsetof(struct batch, msgs) + (count * sizeof(wrp_msg_t *)), align);
+    for (size_t i = 0; i < count; i++) {
+        slots[i].offset = size;
+        size += ALIGN_UP(slots[i].size, align);
+    }
+
+    b = calloc(1, size);
+    if (b) {
+        b->sig   = BATCH_SIGNATURE;
+        b->count = count;
+
+        /* Pass 2: decode each message into its place. */
+        run_pass(&pool, workers, PASS__PLACE, b);
+    }
+
+    stop_workers(&pool, workers);
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.lock);
+
+    if (!b) {
+        free(slots);
+        return WRPE_OUT_OF_MEMORY;
+    }
+
+    for (size_t i = 0; (i < count) && (WRPE_OK == rv); i++) {
+        rv = slots[i].rv;
+    }
+    free(slots);
+
+    *dests = b->msgs;
+
+    return rv;
+}
+
+
+WRPcode wrp_destroy_batch(wrp_msg_t **msgs)
+{
+    struct batch *b;
+
+    if (!msgs) {
+        return WRPE_OK;
+    }
+
+    b = (struct batch *) (((uint8_t *) msgs) - offsetof(struct batch, msgs));
+    if (BATCH_SIGNATURE != b->sig) {
+        return WRPE_NOT_FROM_WRPC;
+    }
+
+    free(b);
+
+    return WRPE_OK;
+}
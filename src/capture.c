@@ -0,0 +1,195 @@
+/* SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "internal.h"
+#include "wrp-c.h"
+
+/*----------------------------------------------------------------------------*/
+/*                                   Macros                                   */
+/*----------------------------------------------------------------------------*/
+#define INITIAL_RECORDS 1024
+
+/*----------------------------------------------------------------------------*/
+/*                               Data Structures                              */
+/*----------------------------------------------------------------------------*/
+struct wrp_capture {
+    const uint8_t *map;
+    size_t len;
+
+    /* Record i is from offsets[i] to offsets[i + 1]. */
+    size_t count;
+    uint64_t *offsets;
+};
+
+/*----------------------------------------------------------------------------*/
+/*                             Internal functions                             */
+/*----------------------------------------------------------------------------*/
+static WRPcode build_index(wrp_capture_t *cap)
+{
+    struct frame_scanner sc = { 0, 0 };
+    size_t size             = INITIAL_RECORDS;
+    size_t offset           = 0;
+
+    cap->offsets = malloc(size * sizeof(uint64_t));
+    if (!cap->offsets) {
+        return WRPE_OUT_OF_MEMORY;
+    }
+    cap->offsets[0] = 0;
+
+    while (offset < cap->len) {
+        enum frame_status status;
+        size_t used;
+
+        status = frame_scan(&sc, &cap->map[offset], cap->len - offset, &used);
+        if (FRAME__INVALID == status) {
+            return WRPE_NOT_MSGPACK_FORMAT;
+        }
+
+        /* A partial record at the end is left out. */
+        if (FRAME__MORE == status) {
+            break;
+        }
+
+        offset += used;
+
+        if (size <= (cap->count + 1)) {
+            uint64_t *tmp = realloc(cap->offsets, 2 * size * sizeof(uint64_t));
+            if (!tmp) {
+                return WRPE_OUT_OF_MEMORY;
+            }
+            cap->offsets = tmp;
+            size *= 2;
+        }
+
+        cap->count++;
+        cap->offsets[cap->count] = offset;
+    }
+
+    return WRPE_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+WRPcode wrp_capture_open(wrp_capture_t **capture, const char *path)
+{
+    wrp_capture_t *cap;
+    struct stat st;
+    WRPcode rv;
+    void *map;
+    int fd;
+
+    if (!capture || !path) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    cap = calloc(1, sizeof(wrp_capture_t));
+    if (!cap) {
+        return WRPE_OUT_OF_MEMORY;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        free(cap);
+        return WRPE_OTHER_ERROR;
+    }
+
+    if ((0 != fstat(fd, &st)) || (st.st_size < 0)
+        || ((uintmax_t) SIZE_MAX < (uintmax_t) st.st_size))
+    {
+        close(fd);
+        free(cap);
+        return WRPE_OTHER_ERROR;
+    }
+
+    cap->len = (size_t) st.st_size;
+    if (cap->len) {
+        map = mmap(NULL, cap->len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (MAP_FAILED == map) {
+            close(fd);
+            free(cap);
+            return WRPE_OTHER_ERROR;
+        }
+        cap->map = (const uint8_t *) map;
+
+        /* The index is built in a single pass from the front. */
+        posix_madvise(map, cap->len, POSIX_MADV_SEQUENTIAL);
+    }
+
+    /* The mapping stays valid after the descriptor is closed. */
+    close(fd);
+
+    rv = build_index(cap);
+    if (WRPE_OK != rv) {
+        wrp_capture_close(cap);
+        return rv;
+    }
+
+    /* Records are decoded on demand in any order after this. */
+    if (cap->len) {
+        posix_madvise((void *) cap->map, cap->len, POSIX_MADV_RANDOM);
+    }
+
+    *capture = cap;
+
+    return WRPE_OK;
+}
+
+
+size_t wrp_capture_count(const wrp_capture_t *cap)
+{
+    return cap ? cap->count : 0;
+}
+
+
+WRPcode wrp_capture_record(const wrp_capture_t *cap, size_t index,
+                           const void **data, size_t *len)
+{
+    if (!cap || (cap->count <= index) || !data || !len) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    *data = &cap->map[cap->offsets[index]];
+    *len  = (size_t) (cap->offsets[index + 1] - cap->offsets[index]);
+
+    return WRPE_OK;
+}
+
+
+WRPcode wrp_capture_get(const wrp_capture_t *cap, size_t index, wrp_msg_t **msg)
+{
+    const void *data;
+    size_t len;
+    WRPcode rv;
+
+    rv = wrp_capture_record(cap, index, &data, &len);
+    if (WRPE_OK != rv) {
+        return rv;
+    }
+
+    return wrp_from_msgpack(data, len, msg);
+}
+
+
+void wrp_capture_close(wrp_capture_t *cap)
+{
+    if (!cap) {
+        return;
+    }
+
+    if (cap->map) {
+        munmap((void *) cap->map, cap->len);
+    }
+    free(cap->offsets);
+    free(cap);
+}
@@ -0,0 +1,272 @@
+/* SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "wrp-c.h"
+
+/*----------------------------------------------------------------------------*/
+/*                               Data Structures                              */
+/*----------------------------------------------------------------------------*/
+
+/* The same walk is used to size the clone and then to fill it in. */
+struct copy {
+    bool place;
+
+    /* Sizing */
+    size_t strings;
+    size_t nvps;
+    size_t bytes;
+
+    /* Placing */
+    struct wrp_lists mem;
+    uint8_t *next;
+};
+
+/*----------------------------------------------------------------------------*/
+/*                             Internal functions                             */
+/*----------------------------------------------------------------------------*/
+static const void *cp_bytes(struct copy *c, const void *data, size_t len)
+{
+    uint8_t *rv;
+
+    if (!len) {
+        return NULL;
+    }
+
+    if (!c->place) {
+        c->bytes += len;
+        return data;
+    }
+
+    rv = c->next;
+    memcpy(rv, data, len);
+    c->next += len;
+
+    return rv;
+}
+
+
+static void cp_str__(struct copy *c, struct wrp_string *s)
+{
+    s->s = (const char *) cp_bytes(c, s->s, s->len);
+}
+
+
+static void cp_int__(struct copy *c, struct wrp_int *i)
+{
+    (void) c;
+
+    if (i->num) {
+        i->__internal_only = *i->num;
+        i->num             = &i->__internal_only;
+    }
+}
+
+
+static void cp_blob_(struct copy *c, struct wrp_blob *b)
+{
+    b->data = (const uint8_t *) cp_bytes(c, b->data, b->len);
+}
+
+
+static void cp_slist(struct copy *c, struct wrp_string_list *l)
+{
+    const struct wrp_string *from = l->list;
+
+    if (!l->count) {
+        l->list = NULL;
+        return;
+    }
+
+    if (!c->place) {
+        c->strings += l->count;
+    } else {
+        l->list = c->mem.strings;
+        c->mem.strings += l->count;
+    }
+
+    for (size_t i = 0; i < l->count; i++) {
+        const void *s = cp_bytes(c, from[i].s, from[i].len);
+
+        if (c->place) {
+            l->list[i].s   = (const char *) s;
+            l->list[i].len = from[i].len;
+        }
+    }
+}
+
+
+static void cp_nvpl_(struct copy *c, struct wrp_nvp_list *l)
+{
+    const struct wrp_nvp *from = l->list;
+
+    if (!l->count) {
+        l->list = NULL;
+        return;
+    }
+
+    if (!c->place) {
+        c->nvps += l->count;
+    } else {
+        l->list = c->mem.nvps;
+        c->mem.nvps += l->count;
+    }
+
+    for (size_t i = 0; i < l->count; i++) {
+        const void *n = cp_bytes(c, from[i].name.s, from[i].name.len);
+        const void *v = cp_bytes(c, from[i].value.s, from[i].value.len);
+
+        if (c->place) {
+            l->list[i].name.s    = (const char *) n;
+            l->list[i].name.len  = from[i].name.len;
+            l->list[i].value.s   = (const char *) v;
+            l->list[i].value.len = from[i].value.len;
+        }
+    }
+}
+
+
+static WRPcode copy_msg(struct copy *c, wrp_msg_t *msg)
+{
+    switch (msg->msg_type) {
+        case WRP_MSG_TYPE__AUTH:
+            cp_int__(c, &msg->u.auth.status);
+            break;
+
+        case WRP_MSG_TYPE__REQ:
+            cp_str__(c, &msg->u.req.dest);
+            cp_str__(c, &msg->u.req.source);
+            cp_blob_(c, &msg->u.req.payload);
+            cp_str__(c, &msg->u.req.trans_id);
+            cp_str__(c, &msg->u.req.accept);
+            cp_str__(c, &msg->u.req.content_type);
+            cp_slist(c, &msg->u.req.headers);
+            cp_nvpl_(c, &msg->u.req.metadata);
+            cp_str__(c, &msg->u.req.msg_id);
+            cp_slist(c, &msg->u.req.partner_ids);
+            cp_int__(c, &msg->u.req.rdr);
+            cp_str__(c, &msg->u.req.session_id);
+            cp_int__(c, &msg->u.req.status);
+            break;
+
+        case WRP_MSG_TYPE__EVENT:
+            cp_str__(c, &msg->u.event.dest);
+            cp_str__(c, &msg->u.event.source);
+            cp_str__(c, &msg->u.event.content_type);
+            cp_slist(c, &msg->u.event.headers);
+            cp_nvpl_(c, &msg->u.event.metadata);
+            cp_str__(c, &msg->u.event.msg_id);
+            cp_slist(c, &msg->u.event.partner_ids);
+            cp_blob_(c, &msg->u.event.payload);
+            cp_str__(c, &msg->u.event.session_id);
+            break;
+
+        case WRP_MSG_TYPE__CREATE:
+        case WRP_MSG_TYPE__RETRIEVE:
+        case WRP_MSG_TYPE__UPDATE:
+        case WRP_MSG_TYPE__DELETE:
+            cp_str__(c, &msg->u.crud.dest);
+            cp_str__(c, &msg->u.crud.source);
+            cp_str__(c, &msg->u.crud.trans_id);
+            cp_str__(c, &msg->u.crud.accept);
+            cp_str__(c, &msg->u.crud.content_type);
+            cp_slist(c, &msg->u.crud.headers);
+            cp_nvpl_(c, &msg->u.crud.metadata);
+            cp_str__(c, &msg->u.crud.msg_id);
+            cp_slist(c, &msg->u.crud.partner_ids);
+            cp_str__(c, &msg->u.crud.path);
+            cp_blob_(c, &msg->u.crud.payload);
+            cp_int__(c, &msg->u.crud.rdr);
+            cp_str__(c, &msg->u.crud.session_id);
+            cp_int__(c, &msg->u.crud.status);
+            break;
+
+        case WRP_MSG_TYPE__SVC_REG:
+            cp_str__(c, &msg->u.reg.service_name);
+            cp_str__(c, &msg->u.reg.url);
+            break;
+
+        case WRP_MSG_TYPE__SVC_ALIVE:
+            break;
+
+        default:
+            return WRPE_NOT_A_WRP_MSG;
+    }
+
+    return WRPE_OK;
+}
+
+
+/* Points the clone at its own copy of a field the original points at. */
+static struct wrp_string *rebase(const wrp_msg_t *src, wrp_msg_t *dest,
+                                 const struct wrp_string *s)
+{
+    const uint8_t *from = (const uint8_t *) src;
+    const uint8_t *at   = (const uint8_t *) s;
+
+    if (!s || (at < from) || ((from + sizeof(wrp_msg_t)) <= at)) {
+        return NULL;
+    }
+
+    return (struct wrp_string *) (((uint8_t *) dest) + (at - from));
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+WRPcode wrp_msg_compact_clone(const wrp_msg_t *src, wrp_msg_t **dest)
+{
+    struct wrp_internal *p = NULL;
+    struct copy c;
+    wrp_msg_t tmp;
+    size_t size;
+    WRPcode rv;
+
+    if (!src || !dest) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    /* Pass 1: size everything using a throw away copy. */
+    memset(&c, 0, sizeof(c));
+    tmp = *src;
+    rv  = copy_msg(&c, &tmp);
+    if (WRPE_OK != rv) {
+        return rv;
+    }
+
+    size = sizeof(struct wrp_internal)
+         + (c.strings * sizeof(struct wrp_string))
+         + (c.nvps * sizeof(struct wrp_nvp))
+         + c.bytes;
+
+    p = calloc(1, size);
+    if (!p) {
+        return WRPE_OUT_OF_MEMORY;
+    }
+
+    p->sig = INTERNAL_SIGNATURE;
+    p->msg = *src;
+
+    /* Pass 2: copy everything in place and fix up the pointers. */
+    c.place       = true;
+    c.mem.strings = (struct wrp_string *) &p[1];
+    c.mem.nvps    = (struct wrp_nvp *) &c.mem.strings[c.strings];
+    c.next        = (uint8_t *) &c.mem.nvps[c.nvps];
+    (void) copy_msg(&c, &p->msg);
+
+    p->msg.source          = rebase(src, &p->msg, src->source);
+    p->msg.dest            = rebase(src, &p->msg, src->dest);
+    p->msg.original.data   = NULL;
+    p->msg.original.len    = 0;
+    p->msg.__internal_only = (void *) p;
+
+    *dest = &p->msg;
+
+    return WRPE_OK;
+}
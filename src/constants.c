@@ -1,32 +1,96 @@
-/* SPDX-FileCopyrightText: 2021 Comcast Cable Communications Management, LLC */
+/* SPDX-FileCopyrightText: 2021-2022 Comcast Cable Communications Management, LLC */
 /* SPDX-License-Identifier: Apache-2.0 */
 
+#include <string.h>
+
 #include "constants.h"
 
 /*----------------------------------------------------------------------------*/
 /*                                   Macros                                   */
 /*----------------------------------------------------------------------------*/
-#define MAKE_TOKEN(str)                  \
-    {                                    \
-        .s = str, .len = sizeof(str) - 1 \
+/* The fixstr header (0xa0 | length) is spelled out since it can't be computed
+ * inside a string literal.  The keys are all shorter than 32 bytes. */
+#define MAKE_TOKEN(field, hdr, str)                                 \
+    {                                                               \
+        .s = str, .len = sizeof(str) - 1, .id = WRP_FIELD__##field, \
+        .packed = hdr str                                           \
     }
 
 // clang-format off
-const struct wrp_token WRP_ACCEPT__ = MAKE_TOKEN( "accept" );
-const struct wrp_token WRP_CT______ = MAKE_TOKEN( "content_type" );
-const struct wrp_token WRP_DEST____ = MAKE_TOKEN( "dest" );
-const struct wrp_token WRP_HEADERS_ = MAKE_TOKEN( "headers" );
-const struct wrp_token WRP_METADATA = MAKE_TOKEN( "metadata" );
-const struct wrp_token WRP_MSG_ID__ = MAKE_TOKEN( "msg_id" );
-const struct wrp_token WRP_MSG_TYPE = MAKE_TOKEN( "msg_type" );
-const struct wrp_token WRP_PARTNERS = MAKE_TOKEN( "partner_ids" );
-const struct wrp_token WRP_PATH____ = MAKE_TOKEN( "path" );
-const struct wrp_token WRP_PAYLOAD_ = MAKE_TOKEN( "payload" );
-const struct wrp_token WRP_RDR_____ = MAKE_TOKEN( "rdr" );
-const struct wrp_token WRP_SESS_ID_ = MAKE_TOKEN( "session_id" );
-const struct wrp_token WRP_SN______ = MAKE_TOKEN( "service_name" );
-const struct wrp_token WRP_SOURCE__ = MAKE_TOKEN( "source" );
-const struct wrp_token WRP_STATUS__ = MAKE_TOKEN( "status" );
-const struct wrp_token WRP_TRANS_ID = MAKE_TOKEN( "transaction_uuid" );
-const struct wrp_token WRP_URL_____ = MAKE_TOKEN( "url" );
+const struct wrp_token WRP_ACCEPT__ = MAKE_TOKEN( ACCEPT,       "\xa6", "accept" );
+const struct wrp_token WRP_CT______ = MAKE_TOKEN( CONTENT_TYPE, "\xac", "content_type" );
+const struct wrp_token WRP_DEST____ = MAKE_TOKEN( DEST,         "\xa4", "dest" );
+const struct wrp_token WRP_HEADERS_ = MAKE_TOKEN( HEADERS,      "\xa7", "headers" );
+const struct wrp_token WRP_METADATA = MAKE_TOKEN( METADATA,     "\xa8", "metadata" );
+const struct wrp_token WRP_MSG_ID__ = MAKE_TOKEN( MSG_ID,       "\xa6", "msg_id" );
+const struct wrp_token WRP_MSG_TYPE = MAKE_TOKEN( MSG_TYPE,     "\xa8", "msg_type" );
+const struct wrp_token WRP_PARTNERS = MAKE_TOKEN( PARTNER_IDS,  "\xab", "partner_ids" );
+const struct wrp_token WRP_PATH____ = MAKE_TOKEN( PATH,         "\xa4", "path" );
+const struct wrp_token WRP_PAYLOAD_ = MAKE_TOKEN( PAYLOAD,      "\xa7", "payload" );
+const struct wrp_token WRP_RDR_____ = MAKE_TOKEN( RDR,          "\xa3", "rdr" );
+const struct wrp_token WRP_SESS_ID_ = MAKE_TOKEN( SESSION_ID,   "\xaa", "session_id" );
+const struct wrp_token WRP_SN______ = MAKE_TOKEN( SERVICE_NAME, "\xac", "service_name" );
+const struct wrp_token WRP_SOURCE__ = MAKE_TOKEN( SOURCE,       "\xa6", "source" );
+const struct wrp_token WRP_STATUS__ = MAKE_TOKEN( STATUS,       "\xa6", "status" );
+const struct wrp_token WRP_TRANS_ID = MAKE_TOKEN( TRANS_ID,     "\xb0", "transaction_uuid" );
+const struct wrp_token WRP_URL_____ = MAKE_TOKEN( URL,          "\xa3", "url" );
 // clang-format on
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+const struct wrp_token *wrp_token_find(const char *s, size_t len)
+{
+    const struct wrp_token *t = NULL;
+
+    if (!s || (len < 3)) {
+        return NULL;
+    }
+
+    /* The length and the first character (and the second one for the two
+     * collisions) are enough to pick the only possible candidate.  The final
+     * memcmp() confirms it. */
+    switch (len) {
+        case 3:
+            if ('r' == s[0]) t = &WRP_RDR_____;
+            if ('u' == s[0]) t = &WRP_URL_____;
+            break;
+        case 4:
+            if ('d' == s[0]) t = &WRP_DEST____;
+            if ('p' == s[0]) t = &WRP_PATH____;
+            break;
+        case 6:
+            if ('a' == s[0]) t = &WRP_ACCEPT__;
+            if ('m' == s[0]) t = &WRP_MSG_ID__;
+            if ('s' == s[0]) t = ('o' == s[1]) ? &WRP_SOURCE__ : &WRP_STATUS__;
+            break;
+        case 7:
+            if ('h' == s[0]) t = &WRP_HEADERS_;
+            if ('p' == s[0]) t = &WRP_PAYLOAD_;
+            break;
+        case 8:
+            if ('m' == s[0]) t = ('e' == s[1]) ? &WRP_METADATA : &WRP_MSG_TYPE;
+            break;
+        case 10:
+            if ('s' == s[0]) t = &WRP_SESS_ID_;
+            break;
+        case 11:
+            if ('p' == s[0]) t = &WRP_PARTNERS;
+            break;
+        case 12:
+            if ('c' == s[0]) t = &WRP_CT______;
+            if ('s' == s[0]) t = &WRP_SN______;
+            break;
+        case 16:
+            if ('t' == s[0]) t = &WRP_TRANS_ID;
+            break;
+        default:
+            break;
+    }
+
+    if (t && (0 == memcmp(t->s, s, len))) {
+        return t;
+    }
+
+    return NULL;
+}
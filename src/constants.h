@@ -5,9 +5,13 @@
 
 #include <stddef.h>
 
+#include "wrp-c.h"
+
 struct wrp_token {
     const char *s;
     size_t len;
+    enum wrp_field id;
+    const char *packed; /* The msgpack fixstr encoding, len + 1 bytes. */
 };
 
 extern const struct wrp_token WRP_ACCEPT__;
@@ -28,4 +32,15 @@ extern const struct wrp_token WRP_STATUS__;
 extern const struct wrp_token WRP_TRANS_ID;
 extern const struct wrp_token WRP_URL_____;
 
+
+/**
+ *  Finds the token that matches the key exactly.
+ *
+ *  @param s   the key to look up (does not need to be '\0' terminated)
+ *  @param len the length of the key
+ *
+ *  @return the matching token or NULL if the key is not known
+ */
+const struct wrp_token *wrp_token_find(const char *s, size_t len);
+
 #endif
@@ -9,19 +9,90 @@
 #include "internal.h"
 #include "wrp-c.h"
 
+/*----------------------------------------------------------------------------*/
+/*                               Data Structures                              */
+/*----------------------------------------------------------------------------*/
+
+/* The values of the known keys in the root map, found in a single pass. */
+struct fields {
+    mpack_node_t root;
+    uint32_t wanted;
+    uint32_t found;
+    uint32_t dups;
+    mpack_node_t nodes[WRP_FIELD__LAST];
+};
+
 /*----------------------------------------------------------------------------*/
 /*                             Internal functions                             */
 /*----------------------------------------------------------------------------*/
-static void get_msg_type(mpack_node_t root, enum wrp_msg_type *t)
+static void index_root(mpack_node_t root, uint32_t wanted, struct fields *f)
+{
+    size_t count;
+
+    f->root   = root;
+    f->wanted = wanted;
+    f->found  = 0;
+    f->dups   = 0;
+
+    /* This flags a type error if the root is not a map. */
+    count = mpack_node_map_count(root);
+
+    for (size_t i = 0; i < count; i++) {
+        const struct wrp_token *token;
+        mpack_node_t key;
+
+        key = mpack_node_map_key_at(root, i);
+        if (mpack_type_str != mpack_node_type(key)) {
+            continue;
+        }
+
+        token = wrp_token_find(mpack_node_str(key), mpack_node_strlen(key));
+        if (!token) {
+            continue;
+        }
+
+        /* A duplicate key is only rejected if the message type uses it. */
+        if (f->found & (1u << token->id)) {
+            f->dups |= (1u << token->id);
+            continue;
+        }
+
+        f->found |= (1u << token->id);
+        f->nodes[token->id] = mpack_node_map_value_at(root, i);
+    }
+}
+
+
+static bool find_node(struct fields *f, const struct wrp_token *token, mpack_node_t *node)
+{
+    /* A duplicate key is ambiguous, so reject it. */
+    if (f->dups & (1u << token->id)) {
+        mpack_node_flag_error(f->root, mpack_error_data);
+        return false;
+    }
+
+    if (f->found & (1u << token->id)) {
+        *node = f->nodes[token->id];
+        return true;
+    }
+
+    return false;
+}
+
+
+static void get_msg_type(struct fields *f, enum wrp_msg_type *t)
 {
     mpack_node_t val;
     uint8_t type;
 
-    val = mpack_node_map_str(root, WRP_MSG_TYPE.s, WRP_MSG_TYPE.len);
+    if (!find_node(f, &WRP_MSG_TYPE, &val)) {
+        mpack_node_flag_error(f->root, mpack_error_data);
+        return;
+    }
 
     type = mpack_node_u8(val);
     if (mpack_ok != mpack_node_error(val)) {
-        mpack_node_flag_error(root, mpack_error_data);
+        mpack_node_flag_error(f->root, mpack_error_data);
     } else {
         *t = (enum wrp_msg_type) type;
     }
@@ -38,77 +109,94 @@ static bool is_valid_node(mpack_node_t node)
 }
 
 
-static mpack_node_t get_node(mpack_node_t root, int flags, const struct wrp_token *token)
+static bool get_node(struct fields *f, int flags, const struct wrp_token *token,
+                     mpack_node_t *node)
 {
-    if (OPTIONAL == flags) {
-        return mpack_node_map_str_optional(root, token->s, token->len);
+    if ((OPTIONAL == flags) && !(f->wanted & (1u << token->id))) {
+        return false;
     }
 
-    return mpack_node_map_str(root, token->s, token->len);
+    if (find_node(f, token, node)) {
+        return is_valid_node(*node);
+    }
+
+    if (REQUIRED == flags) {
+        mpack_node_flag_error(f->root, mpack_error_data);
+    }
+
+    return false;
 }
 
 
-static void dec_str__(mpack_node_t root, int flags, const struct wrp_token *token,
+static void dec_str__(struct fields *f, int flags, const struct wrp_token *token,
                       struct wrp_string *s)
 {
     mpack_node_t val;
 
-    val = get_node(root, flags, token);
-    if (is_valid_node(val)) {
+    if (get_node(f, flags, token, &val)) {
         s->s   = mpack_node_str(val);
         s->len = mpack_node_strlen(val);
     }
 }
 
 
-static void dec_int__(mpack_node_t root, int flags, const struct wrp_token *token,
+static void dec_int__(struct fields *f, int flags, const struct wrp_token *token,
                       struct wrp_int *i)
 {
     mpack_node_t val;
 
     i->num             = NULL;
     i->__internal_only = 0;
-    val                = get_node(root, flags, token);
-    if (is_valid_node(val)) {
+    if (get_node(f, flags, token, &val)) {
         i->__internal_only = mpack_node_int(val);
         i->num             = &i->__internal_only;
     }
 }
 
 
-static void dec_blob_(mpack_node_t root, int flags, const struct wrp_token *token,
+static void dec_blob_(struct fields *f, int flags, const struct wrp_token *token,
                       struct wrp_blob *blob)
 {
     mpack_node_t val;
 
-    val = get_node(root, flags, token);
-    if (is_valid_node(val)) {
+    if (get_node(f, flags, token, &val)) {
         blob->data = (const uint8_t *) mpack_node_bin_data(val);
         blob->len  = mpack_node_bin_size(val);
     }
 }
 
 
-static void dec_slist(mpack_node_t root, int flags, const struct wrp_token *token,
-                      struct wrp_string_list *l, void **free_link)
+static size_t count_of(struct fields *f, const struct wrp_token *token, mpack_type_t type)
+{
+    mpack_node_t val;
+
+    if (!(f->wanted & (1u << token->id)) || !find_node(f, token, &val)
+        || (type != mpack_node_type(val)))
+    {
+        return 0;
+    }
+
+    if (mpack_type_map == type) {
+        return mpack_node_map_count(val);
+    }
+
+    return mpack_node_array_length(val);
+}
+
+
+static void dec_slist(struct fields *f, int flags, const struct wrp_token *token,
+                      struct wrp_string_list *l, struct wrp_lists *mem)
 {
     mpack_node_t list;
 
-    list = get_node(root, flags, token);
-    if (false == is_valid_node(list)) {
+    if (false == get_node(f, flags, token, &list)) {
         return;
     }
 
     l->count = mpack_node_array_length(list);
     if (l->count) {
-        l->list = calloc(l->count, sizeof(struct wrp_string));
-        if (!l->list) {
-            mpack_node_flag_error(list, mpack_error_memory);
-            return;
-        }
-
-        /* Make freeing this easier later. */
-        *free_link = l->list;
+        l->list = mem->strings;
+        mem->strings += l->count;
 
         for (size_t i = 0; i < l->count; i++) {
             mpack_node_t val;
@@ -121,26 +209,19 @@ static void dec_slist(mpack_node_t root, int flags, const struct wrp_token *toke
 }
 
 
-static void dec_nvpl_(mpack_node_t root, int flags, const struct wrp_token *token,
-                      struct wrp_nvp_list *l, void **free_link)
+static void dec_nvpl_(struct fields *f, int flags, const struct wrp_token *token,
+                      struct wrp_nvp_list *l, struct wrp_lists *mem)
 {
     mpack_node_t map;
 
-    map = get_node(root, flags, token);
-    if (false == is_valid_node(map)) {
+    if (false == get_node(f, flags, token, &map)) {
         return;
     }
 
     l->count = mpack_node_map_count(map);
     if (l->count) {
-        l->list = calloc(l->count, sizeof(struct wrp_nvp));
-        if (!l->list) {
-            mpack_node_flag_error(map, mpack_error_memory);
-            return;
-        }
-
-        /* Make freeing this easier later. */
-        *free_link = l->list;
+        l->list = mem->nvps;
+        mem->nvps += l->count;
 
         for (size_t i = 0; i < l->count; i++) {
             mpack_node_t n;
@@ -163,93 +244,185 @@ static void dec_nvpl_(mpack_node_t root, int flags, const struct wrp_token *toke
 }
 
 
-static void decode_root(struct wrp_internal *p)
+static void decode_root(struct fields *f, struct wrp_internal *p, struct wrp_lists *mem)
 {
-    mpack_node_t root;
-    mpack_error_t err;
-
-    root = mpack_tree_root(&p->tree);
-    get_msg_type(root, &p->msg.msg_type);
-    err = mpack_tree_error(&p->tree);
-    if (err != mpack_ok) {
-        return;
-    }
-
     switch (p->msg.msg_type) {
         case WRP_MSG_TYPE__AUTH:
-            dec_int__(root, REQUIRED, &WRP_STATUS__, &p->msg.u.auth.status);
+            dec_int__(f, REQUIRED, &WRP_STATUS__, &p->msg.u.auth.status);
             break;
 
         case WRP_MSG_TYPE__REQ:
-            dec_str__(root, REQUIRED, &WRP_SOURCE__, &p->msg.u.req.source);
-            dec_str__(root, REQUIRED, &WRP_DEST____, &p->msg.u.req.dest);
-            dec_str__(root, REQUIRED, &WRP_TRANS_ID, &p->msg.u.req.trans_id);
-            dec_str__(root, OPTIONAL, &WRP_CT______, &p->msg.u.req.content_type);
-            dec_str__(root, OPTIONAL, &WRP_ACCEPT__, &p->msg.u.req.accept);
-            dec_int__(root, OPTIONAL, &WRP_RDR_____, &p->msg.u.req.rdr);
-            dec_int__(root, OPTIONAL, &WRP_STATUS__, &p->msg.u.req.status);
-            dec_blob_(root, OPTIONAL, &WRP_PAYLOAD_, &p->msg.u.req.payload);
-            dec_slist(root, OPTIONAL, &WRP_PARTNERS, &p->msg.u.req.partner_ids, &p->partner_ids);
-            dec_nvpl_(root, OPTIONAL, &WRP_METADATA, &p->msg.u.req.metadata, &p->metadata);
-            dec_slist(root, OPTIONAL, &WRP_HEADERS_, &p->msg.u.req.headers, &p->headers);
-            dec_str__(root, OPTIONAL, &WRP_MSG_ID__, &p->msg.u.req.msg_id);
-            dec_str__(root, OPTIONAL, &WRP_SESS_ID_, &p->msg.u.req.session_id);
+            /* The payload of a request is required, so the mask can't drop
+             * it, but a missing one is still accepted. */
+            f->wanted |= WRP_FIELD_BIT(WRP_FIELD__PAYLOAD);
+
+            dec_str__(f, REQUIRED, &WRP_SOURCE__, &p->msg.u.req.source);
+            dec_str__(f, REQUIRED, &WRP_DEST____, &p->msg.u.req.dest);
+            dec_str__(f, REQUIRED, &WRP_TRANS_ID, &p->msg.u.req.trans_id);
+            dec_str__(f, OPTIONAL, &WRP_CT______, &p->msg.u.req.content_type);
+            dec_str__(f, OPTIONAL, &WRP_ACCEPT__, &p->msg.u.req.accept);
+            dec_int__(f, OPTIONAL, &WRP_RDR_____, &p->msg.u.req.rdr);
+            dec_int__(f, OPTIONAL, &WRP_STATUS__, &p->msg.u.req.status);
+            dec_blob_(f, OPTIONAL, &WRP_PAYLOAD_, &p->msg.u.req.payload);
+            dec_slist(f, OPTIONAL, &WRP_PARTNERS, &p->msg.u.req.partner_ids, mem);
+            dec_nvpl_(f, OPTIONAL, &WRP_METADATA, &p->msg.u.req.metadata, mem);
+            dec_slist(f, OPTIONAL, &WRP_HEADERS_, &p->msg.u.req.headers, mem);
+            dec_str__(f, OPTIONAL, &WRP_MSG_ID__, &p->msg.u.req.msg_id);
+            dec_str__(f, OPTIONAL, &WRP_SESS_ID_, &p->msg.u.req.session_id);
             break;
 
         case WRP_MSG_TYPE__EVENT:
-            dec_str__(root, REQUIRED, &WRP_SOURCE__, &p->msg.u.event.source);
-            dec_str__(root, REQUIRED, &WRP_DEST____, &p->msg.u.event.dest);
-            dec_str__(root, OPTIONAL, &WRP_CT______, &p->msg.u.event.content_type);
-            dec_blob_(root, OPTIONAL, &WRP_PAYLOAD_, &p->msg.u.event.payload);
-            dec_slist(root, OPTIONAL, &WRP_PARTNERS, &p->msg.u.event.partner_ids, &p->partner_ids);
-            dec_nvpl_(root, OPTIONAL, &WRP_METADATA, &p->msg.u.event.metadata, &p->metadata);
-            dec_slist(root, OPTIONAL, &WRP_HEADERS_, &p->msg.u.event.headers, &p->headers);
-            dec_str__(root, OPTIONAL, &WRP_MSG_ID__, &p->msg.u.event.msg_id);
-            dec_str__(root, OPTIONAL, &WRP_SESS_ID_, &p->msg.u.event.session_id);
+            dec_str__(f, REQUIRED, &WRP_SOURCE__, &p->msg.u.event.source);
+            dec_str__(f, REQUIRED, &WRP_DEST____, &p->msg.u.event.dest);
+            dec_str__(f, OPTIONAL, &WRP_CT______, &p->msg.u.event.content_type);
+            dec_blob_(f, OPTIONAL, &WRP_PAYLOAD_, &p->msg.u.event.payload);
+            dec_slist(f, OPTIONAL, &WRP_PARTNERS, &p->msg.u.event.partner_ids, mem);
+            dec_nvpl_(f, OPTIONAL, &WRP_METADATA, &p->msg.u.event.metadata, mem);
+            dec_slist(f, OPTIONAL, &WRP_HEADERS_, &p->msg.u.event.headers, mem);
+            dec_str__(f, OPTIONAL, &WRP_MSG_ID__, &p->msg.u.event.msg_id);
+            dec_str__(f, OPTIONAL, &WRP_SESS_ID_, &p->msg.u.event.session_id);
             break;
 
         case WRP_MSG_TYPE__CREATE:
         case WRP_MSG_TYPE__RETRIEVE:
         case WRP_MSG_TYPE__UPDATE:
         case WRP_MSG_TYPE__DELETE:
-            dec_str__(root, REQUIRED, &WRP_SOURCE__, &p->msg.u.crud.source);
-            dec_str__(root, REQUIRED, &WRP_DEST____, &p->msg.u.crud.dest);
-            dec_str__(root, REQUIRED, &WRP_TRANS_ID, &p->msg.u.crud.trans_id);
-            dec_str__(root, OPTIONAL, &WRP_CT______, &p->msg.u.crud.content_type);
-            dec_str__(root, OPTIONAL, &WRP_ACCEPT__, &p->msg.u.crud.accept);
-            dec_str__(root, OPTIONAL, &WRP_PATH____, &p->msg.u.crud.path);
-            dec_int__(root, OPTIONAL, &WRP_RDR_____, &p->msg.u.crud.rdr);
-            dec_int__(root, OPTIONAL, &WRP_STATUS__, &p->msg.u.crud.status);
-            dec_blob_(root, OPTIONAL, &WRP_PAYLOAD_, &p->msg.u.crud.payload);
-            dec_slist(root, OPTIONAL, &WRP_PARTNERS, &p->msg.u.crud.partner_ids, &p->partner_ids);
-            dec_nvpl_(root, OPTIONAL, &WRP_METADATA, &p->msg.u.crud.metadata, &p->metadata);
-            dec_slist(root, OPTIONAL, &WRP_HEADERS_, &p->msg.u.crud.headers, &p->headers);
-            dec_str__(root, OPTIONAL, &WRP_MSG_ID__, &p->msg.u.crud.msg_id);
-            dec_str__(root, OPTIONAL, &WRP_SESS_ID_, &p->msg.u.crud.session_id);
+            dec_str__(f, REQUIRED, &WRP_SOURCE__, &p->msg.u.crud.source);
+            dec_str__(f, REQUIRED, &WRP_DEST____, &p->msg.u.crud.dest);
+            dec_str__(f, REQUIRED, &WRP_TRANS_ID, &p->msg.u.crud.trans_id);
+            dec_str__(f, OPTIONAL, &WRP_CT______, &p->msg.u.crud.content_type);
+            dec_str__(f, OPTIONAL, &WRP_ACCEPT__, &p->msg.u.crud.accept);
+            dec_str__(f, OPTIONAL, &WRP_PATH____, &p->msg.u.crud.path);
+            dec_int__(f, OPTIONAL, &WRP_RDR_____, &p->msg.u.crud.rdr);
+            dec_int__(f, OPTIONAL, &WRP_STATUS__, &p->msg.u.crud.status);
+            dec_blob_(f, OPTIONAL, &WRP_PAYLOAD_, &p->msg.u.crud.payload);
+            dec_slist(f, OPTIONAL, &WRP_PARTNERS, &p->msg.u.crud.partner_ids, mem);
+            dec_nvpl_(f, OPTIONAL, &WRP_METADATA, &p->msg.u.crud.metadata, mem);
+            dec_slist(f, OPTIONAL, &WRP_HEADERS_, &p->msg.u.crud.headers, mem);
+            dec_str__(f, OPTIONAL, &WRP_MSG_ID__, &p->msg.u.crud.msg_id);
+            dec_str__(f, OPTIONAL, &WRP_SESS_ID_, &p->msg.u.crud.session_id);
             break;
 
         case WRP_MSG_TYPE__SVC_REG:
-            dec_str__(root, REQUIRED, &WRP_SN______, &p->msg.u.reg.service_name);
-            dec_str__(root, REQUIRED, &WRP_URL_____, &p->msg.u.reg.url);
+            dec_str__(f, REQUIRED, &WRP_SN______, &p->msg.u.reg.service_name);
+            dec_str__(f, REQUIRED, &WRP_URL_____, &p->msg.u.reg.url);
             break;
 
         case WRP_MSG_TYPE__SVC_ALIVE:
             break;
 
         default:
-            mpack_node_flag_error(root, mpack_error_data);
+            mpack_node_flag_error(f->root, mpack_error_data);
     }
 }
 
 
+mpack_error_t decode_tree(mpack_tree_t *tree, uint32_t fields, storage_fn fn,
+                          void *ctx, struct wrp_internal **out)
+{
+    struct wrp_internal *p = NULL;
+    struct wrp_lists mem   = { NULL, NULL, NULL };
+    enum wrp_msg_type type = 0;
+    size_t strings         = 0;
+    size_t nvps            = 0;
+    size_t slots           = 0;
+    size_t hdrs            = 0;
+    size_t hdr_slots       = 0;
+    mpack_error_t err;
+    struct fields f;
+
+    index_root(mpack_tree_root(tree), fields, &f);
+    get_msg_type(&f, &type);
+
+    /* Only count the lists that are well formed; the rest fail later. */
+    if (has_lists(type)) {
+        strings = count_of(&f, &WRP_PARTNERS, mpack_type_array)
+                + count_of(&f, &WRP_HEADERS_, mpack_type_array);
+        nvps = count_of(&f, &WRP_METADATA, mpack_type_map);
+        if (fields & WRP_INDEX_METADATA) {
+            slots = index_slots(nvps);
+        }
+
+        /* The split headers need a view each, after the metadata. */
+        if (fields & WRP_INDEX_HEADERS) {
+            hdrs      = count_of(&f, &WRP_HEADERS_, mpack_type_array);
+            hdr_slots = index_slots(hdrs);
+        }
+    }
+
+    err = mpack_tree_error(tree);
+    if (mpack_ok == err) {
+        err = fn(ctx, strings, nvps + hdrs, slots + hdr_slots, &p, &mem);
+    }
+
+    if (mpack_ok == err) {
+        p->sig                 = INTERNAL_SIGNATURE;
+        p->msg.__internal_only = (void *) p;
+        p->msg.msg_type        = type;
+
+        decode_root(&f, p, &mem);
+        err = mpack_tree_error(tree);
+    }
+
+    if ((mpack_ok == err) && slots) {
+        const struct wrp_nvp_list *l = metadata_of(&p->msg);
+
+        index_build(&p->metadata, l->list, l->count, mem.slots, slots, false);
+        p->metadata.of       = l->list;
+        p->metadata.of_count = l->count;
+    }
+
+    if ((mpack_ok == err) && hdr_slots) {
+        const struct wrp_string_list *l = headers_of(&p->msg);
+
+        hdrs = split_headers(l, mem.nvps);
+        index_build(&p->headers, mem.nvps, hdrs, &mem.slots[slots], hdr_slots, true);
+        p->headers.of       = l->list;
+        p->headers.of_count = l->count;
+    }
+
+    *out = p;
+
+    return err;
+}
+
+
+/* The message and its lists are placed in a single allocation. */
+static mpack_error_t alloc_msg(void *ctx, size_t strings, size_t nvps, size_t slots,
+                               struct wrp_internal **p, struct wrp_lists *mem)
+{
+    (void) ctx;
+
+    *p = calloc(1, sizeof(struct wrp_internal)
+                       + (strings * sizeof(struct wrp_string))
+                       + (nvps * sizeof(struct wrp_nvp))
+                       + (slots * sizeof(uint32_t)));
+    if (!*p) {
+        return mpack_error_memory;
+    }
+
+    mem->strings = (struct wrp_string *) &(*p)[1];
+    mem->nvps    = (struct wrp_nvp *) &mem->strings[strings];
+    mem->slots   = (uint32_t *) &mem->nvps[nvps];
+
+    return mpack_ok;
+}
+
+
 /*----------------------------------------------------------------------------*/
 /*                             External Functions                             */
 /*----------------------------------------------------------------------------*/
+WRPcode wrp_from_msgpack(const void *data, size_t len, wrp_msg_t **msg)
+{
+    return wrp_from_msgpack_ex(data, len, WRP_FIELDS_ALL, msg);
+}
 
 
-WRPcode wrp_from_msgpack(const void *data, size_t len, wrp_msg_t **msg)
+WRPcode wrp_from_msgpack_ex(const void *data, size_t len, uint32_t fields,
+                            wrp_msg_t **msg)
 {
-    struct wrp_internal *p;
+    struct wrp_internal *p = NULL;
+    mpack_tree_t tree;
     mpack_error_t err;
     WRPcode rv = WRPE_OK;
 
@@ -257,25 +430,19 @@ WRPcode wrp_from_msgpack(const void *data, size_t len, wrp_msg_t **msg)
         return WRPE_INVALID_ARGS;
     }
 
-    p = calloc(1, sizeof(struct wrp_internal));
-    if (!p) {
-        return WRPE_OUT_OF_MEMORY;
-    }
-
-    p->sig = INTERNAL_SIGNATURE;
-
-    mpack_tree_init_data(&p->tree, data, len);
-    mpack_tree_parse(&p->tree);
-    decode_root(p);
-    err = mpack_tree_error(&p->tree);
+    /* The decoded strings point into the data, not into the tree, so the
+     * tree is only needed while decoding. */
+    mpack_tree_init_data(&tree, data, len);
+    mpack_tree_parse(&tree);
+    err = decode_tree(&tree, fields, alloc_msg, NULL, &p);
+    mpack_tree_destroy(&tree);
 
     rv = map_mpack_err(err);
     if (WRPE_OK != rv) {
-        mpack_tree_destroy(&p->tree);
-        free(p);
+        if (p) {
+            wrp_destroy(&p->msg);
+        }
     } else {
-        p->msg.__internal_only = (void *) p;
-
         *msg = &p->msg;
     }
 
@@ -296,18 +463,11 @@ WRPcode wrp_destroy(wrp_msg_t *msg)
         return WRPE_NOT_FROM_WRPC;
     }
 
-    mpack_tree_destroy(&p->tree);
-
-    if (p->partner_ids) {
-        free(p->partner_ids);
-    }
-    if (p->metadata) {
-        free(p->metadata);
-    }
-    if (p->headers) {
-        free(p->headers);
+    if (p->external) {
+        return WRPE_OK;
     }
 
+    /* The lists are in the same allocation as the message. */
     free(p);
 
     return WRPE_OK;
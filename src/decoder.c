@@ -0,0 +1,188 @@
+/* SPDX-FileCopyrightText: 2021-2022 Comcast Cable Communications Management, LLC */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "wrp-c.h"
+
+/*----------------------------------------------------------------------------*/
+/*                                   Macros                                   */
+/*----------------------------------------------------------------------------*/
+#define INITIAL_NODE_COUNT 32
+
+/*----------------------------------------------------------------------------*/
+/*                               Data Structures                              */
+/*----------------------------------------------------------------------------*/
+struct wrp_decoder {
+    mpack_node_data_t *nodes;
+    size_t node_count;
+
+    struct wrp_string *strings;
+    size_t string_count;
+
+    struct wrp_nvp *nvps;
+    size_t nvp_count;
+
+    /* The message handed out by the most recent decode. */
+    struct wrp_internal p;
+};
+
+/*----------------------------------------------------------------------------*/
+/*                             Internal functions                             */
+/*----------------------------------------------------------------------------*/
+
+/* Grows the buffer geometrically so it can hold at least want items. */
+static bool grow(void **buf, size_t *count, size_t want, size_t size)
+{
+    size_t next = *count;
+    void *tmp;
+
+    if (want <= *count) {
+        return true;
+    }
+
+    if (!next) {
+        next = 1;
+    }
+    while (next < want) {
+        next *= 2;
+    }
+
+    tmp = realloc(*buf, next * size);
+    if (!tmp) {
+        return false;
+    }
+
+    *buf   = tmp;
+    *count = next;
+
+    return true;
+}
+
+
+static mpack_error_t use_decoder(void *ctx, size_t strings, size_t nvps, size_t slots,
+                                 struct wrp_internal **p, struct wrp_lists *mem)
+{
+    wrp_decoder_t *d = (wrp_decoder_t *) ctx;
+
+    /* The decoder never asks for an index. */
+    (void) slots;
+
+    if (!grow((void **) &d->strings, &d->string_count, strings, sizeof(struct wrp_string))
+        || !grow((void **) &d->nvps, &d->nvp_count, nvps, sizeof(struct wrp_nvp)))
+    {
+        return mpack_error_memory;
+    }
+
+    memset(&d->p, 0, sizeof(d->p));
+    if (strings) {
+        memset(d->strings, 0, strings * sizeof(struct wrp_string));
+    }
+    if (nvps) {
+        memset(d->nvps, 0, nvps * sizeof(struct wrp_nvp));
+    }
+
+    d->p.external = true;
+    mem->strings  = d->strings;
+    mem->nvps     = d->nvps;
+    *p            = &d->p;
+
+    return mpack_ok;
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+WRPcode wrp_decoder_create(wrp_decoder_t **dec)
+{
+    if (!dec) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    *dec = calloc(1, sizeof(wrp_decoder_t));
+    if (!*dec) {
+        return WRPE_OUT_OF_MEMORY;
+    }
+
+    return WRPE_OK;
+}
+
+
+WRPcode wrp_decoder_decode(wrp_decoder_t *dec, const void *src, size_t len,
+                           wrp_msg_t **dest)
+{
+    struct wrp_internal *p = NULL;
+    mpack_error_t err;
+
+    if (!dec || !src || !len || !dest) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    if (!dec->nodes
+        && !grow((void **) &dec->nodes, &dec->node_count, INITIAL_NODE_COUNT,
+                 sizeof(mpack_node_data_t)))
+    {
+        return WRPE_OUT_OF_MEMORY;
+    }
+
+    do {
+        mpack_tree_t tree;
+
+        mpack_tree_init_pool(&tree, src, len, dec->nodes, dec->node_count);
+        mpack_tree_parse(&tree);
+        err = mpack_tree_error(&tree);
+        if (mpack_ok == err) {
+            err = decode_tree(&tree, WRP_FIELDS_ALL, use_decoder, dec, &p);
+        }
+        mpack_tree_destroy(&tree);
+
+        /* Every node takes at least one byte, so a pool with as many nodes
+         * as there are bytes is never too small. */
+        if ((mpack_error_too_big == err) && (dec->node_count < len)) {
+            if (!grow((void **) &dec->nodes, &dec->node_count,
+                      dec->node_count + 1, sizeof(mpack_node_data_t)))
+            {
+                return WRPE_OUT_OF_MEMORY;
+            }
+            continue;
+        }
+        break;
+    } while (1);
+
+    if (mpack_ok != err) {
+        return map_mpack_err(err);
+    }
+
+    *dest = &p->msg;
+
+    return WRPE_OK;
+}
+
+
+void wrp_decoder_reset(wrp_decoder_t *dec)
+{
+    if (!dec) {
+        return;
+    }
+
+    free(dec->nodes);
+    free(dec->strings);
+    free(dec->nvps);
+
+    memset(dec, 0, sizeof(wrp_decoder_t));
+}
+
+
+void wrp_decoder_destroy(wrp_decoder_t *dec)
+{
+    if (!dec) {
+        return;
+    }
+
+    wrp_decoder_reset(dec);
+    free(dec);
+}
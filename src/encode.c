@@ -4,7 +4,9 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 
 #include "constants.h"
 #include "internal.h"
@@ -14,12 +16,60 @@
 /*----------------------------------------------------------------------------*/
 /*                                   Macros                                   */
 /*----------------------------------------------------------------------------*/
-/* none */
+#define LEN32_PREFIX 4
 
 /*----------------------------------------------------------------------------*/
 /*                               Data Structures                              */
 /*----------------------------------------------------------------------------*/
-/* none */
+
+/* The same field logic is used to size a message and to write it, so the two
+ * can never disagree.  The bytes are written directly at next when it is set,
+ * through the mpack writer w when it is set, and otherwise only the size is
+ * added up. */
+struct enc {
+    uint8_t *start;
+    uint8_t *next;
+    mpack_writer_t *w;
+    size_t len;
+
+    /* When iov is set the payload bytes are left out of the encoding and
+     * only where they belong is recorded. */
+    bool iov;
+    const uint8_t *payload;
+    size_t payload_len;
+    size_t at;
+
+    /* When vary is set the varying fields are left out and the cuts where
+     * they belong are recorded.  When tmpl is set too the varying fields are
+     * spliced in between the runs of pre-encoded bytes. */
+    uint32_t vary;
+    size_t *cuts;
+    size_t ncuts;
+    const struct wrp_template *tmpl;
+    size_t run;
+    size_t keys;
+    size_t pairs;
+};
+
+
+/* The invariant fields of a message, encoded once.  Run i of the bytes is from
+ * cuts[i - 1] (or 0) to cuts[i], and varying field i goes after run i. */
+struct wrp_template {
+    enum wrp_msg_type msg_type;
+    uint32_t vary;
+    size_t keys;
+    size_t ncuts;
+    size_t cuts[WRP_FIELD__LAST + 1];
+    uint8_t *bytes;
+};
+
+
+/* The state behind a writer that flushes to the caller. */
+struct flush {
+    wrp_flush_fn fn;
+    void *ctx;
+    WRPcode rv;
+};
 
 /*----------------------------------------------------------------------------*/
 /*                            File Scoped Variables                           */
@@ -34,117 +84,436 @@
 /*----------------------------------------------------------------------------*/
 /*                             Internal functions                             */
 /*----------------------------------------------------------------------------*/
-static void enc_str__(mpack_writer_t *w, int flags, const struct wrp_token *token,
+
+/* The header sizes follow the smallest encodings mpack picks. */
+static size_t str_hdr(uint32_t n)
+{
+    if (n <= 31) {
+        return 1;
+    }
+    if (n <= UINT8_MAX) {
+        return 2;
+    }
+    return (n <= UINT16_MAX) ? 3 : 5;
+}
+
+
+static size_t bin_hdr(uint32_t n)
+{
+    if (n <= UINT8_MAX) {
+        return 2;
+    }
+    return (n <= UINT16_MAX) ? 3 : 5;
+}
+
+
+static size_t container_hdr(uint32_t n)
+{
+    if (n <= 15) {
+        return 1;
+    }
+    return (n <= UINT16_MAX) ? 3 : 5;
+}
+
+
+static size_t int_len(int64_t i)
+{
+    if (127 < i) {
+        if (i <= UINT8_MAX) {
+            return 2;
+        }
+        if (i <= UINT16_MAX) {
+            return 3;
+        }
+        return (i <= UINT32_MAX) ? 5 : 9;
+    }
+
+    if (-32 <= i) {
+        return 1;
+    }
+    if (INT8_MIN <= i) {
+        return 2;
+    }
+    if (INT16_MIN <= i) {
+        return 3;
+    }
+    return (INT32_MIN <= i) ? 5 : 9;
+}
+
+
+/* Maps a header length to its type: base for 8 bit values, base + 1 for 16
+ * bits, base + 2 for 32 bits and base + 3 for 64 bits. */
+static uint8_t type_of(size_t n, uint8_t base)
+{
+    switch (n) {
+        case 2:
+            return base;
+        case 3:
+            return (uint8_t) (base + 1);
+        case 5:
+            return (uint8_t) (base + 2);
+        default:
+            break;
+    }
+
+    return (uint8_t) (base + 3);
+}
+
+
+/* Writes the type byte followed by the n - 1 byte big endian value. */
+static void raw_hdr(struct enc *e, size_t n, uint8_t type, uint64_t v)
+{
+    uint8_t *p = e->next;
+
+    *p++ = type;
+    for (size_t i = n - 1; 0 < i; i--) {
+        *p++ = (uint8_t) (v >> (8 * (i - 1)));
+    }
+
+    e->next = p;
+}
+
+
+static void raw_bytes(struct enc *e, const void *data, size_t len)
+{
+    if (len) {
+        memcpy(e->next, data, len);
+        e->next += len;
+    }
+}
+
+
+/* Keys are written from their pre-encoded form. */
+static void put_key(struct enc *e, const struct wrp_token *token)
+{
+    if (e->next) {
+        raw_bytes(e, token->packed, token->len + 1);
+    } else if (e->w) {
+        mpack_write_object_bytes(e->w, token->packed, token->len + 1);
+    }
+    e->len += token->len + 1;
+    e->keys++;
+}
+
+
+static void put_str(struct enc *e, const char *s, uint32_t len)
+{
+    size_t n = str_hdr(len);
+
+    if (e->next) {
+        if (1 == n) {
+            raw_hdr(e, 1, (uint8_t) (0xa0 | len), 0);
+        } else {
+            raw_hdr(e, n, type_of(n, 0xd9), len);
+        }
+        raw_bytes(e, s, len);
+    } else if (e->w) {
+        mpack_write_str(e->w, s, len);
+    }
+    e->len += n + len;
+}
+
+
+static void put_bin(struct enc *e, const uint8_t *data, uint32_t len)
+{
+    size_t n = bin_hdr(len);
+
+    if (e->next) {
+        raw_hdr(e, n, type_of(n, 0xc4), len);
+
+        if (e->iov && len) {
+            /* Only the header is written, the caller sends the data itself. */
+            e->at = (size_t) (e->next - e->start);
+        } else {
+            raw_bytes(e, data, len);
+        }
+    } else if (e->w) {
+        mpack_write_bin(e->w, (const char *) data, len);
+    }
+
+    if (e->iov && len) {
+        e->payload     = data;
+        e->payload_len = len;
+        len            = 0;
+    }
+    e->len += n + len;
+}
+
+
+static void put_int(struct enc *e, int64_t i)
+{
+    size_t n = int_len(i);
+
+    if (e->next) {
+        if (1 == n) {
+            raw_hdr(e, 1, (uint8_t) i, 0);
+        } else {
+            raw_hdr(e, n, type_of(n, (0 < i) ? 0xcc : 0xd0), (uint64_t) i);
+        }
+    } else if (e->w) {
+        mpack_write_int(e->w, i);
+    }
+    e->len += n;
+}
+
+
+static void put_nil(struct enc *e)
+{
+    if (e->next) {
+        raw_hdr(e, 1, 0xc0, 0);
+    } else if (e->w) {
+        mpack_write_nil(e->w);
+    }
+    e->len += 1;
+}
+
+
+static void start_map(struct enc *e, uint32_t count)
+{
+    size_t n = container_hdr(count);
+
+    if (e->next) {
+        if (1 == n) {
+            raw_hdr(e, 1, (uint8_t) (0x80 | count), 0);
+        } else {
+            raw_hdr(e, n, type_of(n, 0xdd), count);
+        }
+    } else if (e->w) {
+        mpack_start_map(e->w, count);
+    }
+    e->len += n;
+}
+
+
+static void finish_map(struct enc *e)
+{
+    if (e->w) {
+        mpack_finish_map(e->w);
+    }
+}
+
+
+static void start_array(struct enc *e, uint32_t count)
+{
+    size_t n = container_hdr(count);
+
+    if (e->next) {
+        if (1 == n) {
+            raw_hdr(e, 1, (uint8_t) (0x90 | count), 0);
+        } else {
+            raw_hdr(e, n, type_of(n, 0xdb), count);
+        }
+    } else if (e->w) {
+        mpack_start_array(e->w, count);
+    }
+    e->len += n;
+}
+
+
+static void finish_array(struct enc *e)
+{
+    if (e->w) {
+        mpack_finish_array(e->w);
+    }
+}
+
+
+static void emit_run(struct enc *e)
+{
+    const struct wrp_template *t = e->tmpl;
+    size_t from = (0 < e->run) ? t->cuts[e->run - 1] : 0;
+    size_t to   = t->cuts[e->run];
+
+    if (e->next) {
+        raw_bytes(e, &t->bytes[from], to - from);
+    }
+    e->len += to - from;
+    e->run++;
+}
+
+
+/* Returns if the field is left out of what is written. */
+static bool skip(struct enc *e, const struct wrp_token *token)
+{
+    if (!(e->vary & WRP_FIELD_BIT(token->id))) {
+        /* The invariant fields are already in the runs. */
+        return (NULL != e->tmpl);
+    }
+
+    if (e->tmpl) {
+        emit_run(e);
+        return false;
+    }
+
+    e->cuts[e->ncuts++] = e->len;
+    return true;
+}
+
+
+/* The map of the message itself, which has a count that depends on both the
+ * template and the message being spliced into it. */
+static void start_msg(struct enc *e, uint32_t count)
+{
+    if (!e->vary) {
+        start_map(e, count);
+        return;
+    }
+
+    /* Templates don't hold the map header, and when splicing it is only known
+     * after sizing the message, which adds it. */
+    if (e->tmpl && e->next) {
+        start_map(e, (uint32_t) e->pairs);
+    }
+}
+
+
+static void finish_msg(struct enc *e)
+{
+    if (e->tmpl) {
+        emit_run(e);
+    } else if (e->vary) {
+        e->cuts[e->ncuts] = e->len;
+    }
+
+    finish_map(e);
+}
+
+
+static void enc_str__(struct enc *e, int flags, const struct wrp_token *token,
                       const struct wrp_string *s)
 {
     bool val_present = ((0 < s->len) && (NULL != s->s)) ? true : false;
 
+    if (skip(e, token)) {
+        return;
+    }
+
     if (val_present || (REQUIRED == flags)) {
-        mpack_write_str(w, token->s, (uint32_t) token->len);
+        put_key(e, token);
     }
 
     if (val_present) {
-        mpack_write_str(w, s->s, (uint32_t) s->len);
+        put_str(e, s->s, (uint32_t) s->len);
     } else if (REQUIRED) {
-        mpack_write_str(w, NULL, 0);
+        put_str(e, NULL, 0);
     }
 }
 
 
-static void enc_mtype(mpack_writer_t *w, enum wrp_msg_type i)
+static void enc_mtype(struct enc *e, enum wrp_msg_type i)
 {
-    mpack_write_str(w, WRP_MSG_TYPE.s, (uint32_t) WRP_MSG_TYPE.len);
-    mpack_write_int(w, i);
+    if (skip(e, &WRP_MSG_TYPE)) {
+        return;
+    }
+
+    put_key(e, &WRP_MSG_TYPE);
+    put_int(e, i);
 }
 
 
-static void enc_int__(mpack_writer_t *w, int flags, const struct wrp_token *token,
+static void enc_int__(struct enc *e, int flags, const struct wrp_token *token,
                       const struct wrp_int *i)
 {
+    if (skip(e, token)) {
+        return;
+    }
+
     if (i->num || (REQUIRED == flags)) {
-        mpack_write_str(w, token->s, (uint32_t) token->len);
+        put_key(e, token);
     }
 
     if (i->num) {
-        mpack_write_int(w, *i->num);
+        put_int(e, *i->num);
     } else if (REQUIRED) {
-        mpack_write_nil(w);
+        put_nil(e);
     }
 }
 
 
-static void enc_blob_(mpack_writer_t *w, int flags, const struct wrp_token *token,
+static void enc_blob_(struct enc *e, int flags, const struct wrp_token *token,
                       const struct wrp_blob *blob)
 {
     bool val_present = ((0 < blob->len) && (NULL != blob->data)) ? true : false;
 
+    if (skip(e, token)) {
+        return;
+    }
+
     if (val_present || (REQUIRED == flags)) {
-        mpack_write_str(w, token->s, (uint32_t) token->len);
+        put_key(e, token);
     }
 
     if (val_present) {
-        mpack_write_bin(w, (const char *) blob->data, (uint32_t) blob->len);
+        put_bin(e, blob->data, (uint32_t) blob->len);
     } else if (REQUIRED) {
-        mpack_write_bin(w, NULL, 0);
+        put_bin(e, NULL, 0);
     }
 }
 
 
-static void enc_slist(mpack_writer_t *w, int flags, const struct wrp_token *token,
+static void enc_slist(struct enc *e, int flags, const struct wrp_token *token,
                       const struct wrp_string_list *l)
 {
     bool val_present = ((0 < l->count) && (NULL != l->list)) ? true : false;
 
+    if (skip(e, token)) {
+        return;
+    }
+
     if (val_present || (REQUIRED == flags)) {
-        mpack_write_str(w, token->s, (uint32_t) token->len);
+        put_key(e, token);
     }
 
     if (val_present) {
-        mpack_start_array(w, (uint32_t) l->count);
+        start_array(e, (uint32_t) l->count);
         for (size_t i = 0; i < l->count; i++) {
-            mpack_write_str(w, l->list[i].s, (uint32_t) l->list[i].len);
+            put_str(e, l->list[i].s, (uint32_t) l->list[i].len);
         }
-        mpack_finish_array(w);
+        finish_array(e);
     } else if (REQUIRED) {
-        mpack_start_array(w, 0);
-        mpack_finish_array(w);
+        start_array(e, 0);
+        finish_array(e);
     }
 }
 
 
-static void enc_nvpl_(mpack_writer_t *w, int flags, const struct wrp_token *token,
+static void enc_nvpl_(struct enc *e, int flags, const struct wrp_token *token,
                       const struct wrp_nvp_list *l)
 {
     bool val_present = ((0 < l->count) && (NULL != l->list)) ? true : false;
 
+    if (skip(e, token)) {
+        return;
+    }
+
     if (val_present || (REQUIRED == flags)) {
-        mpack_write_str(w, token->s, (uint32_t) token->len);
+        put_key(e, token);
     }
 
     if (val_present) {
-        mpack_start_map(w, (uint32_t) l->count);
+        start_map(e, (uint32_t) l->count);
         for (size_t i = 0; i < l->count; i++) {
-            mpack_write_str(w, l->list[i].name.s, (uint32_t) l->list[i].name.len);
-            mpack_write_str(w, l->list[i].value.s, (uint32_t) l->list[i].value.len);
+            put_str(e, l->list[i].name.s, (uint32_t) l->list[i].name.len);
+            put_str(e, l->list[i].value.s, (uint32_t) l->list[i].value.len);
         }
-        mpack_finish_map(w);
+        finish_map(e);
     } else if (REQUIRED) {
-        mpack_start_map(w, 0);
-        mpack_finish_map(w);
+        start_map(e, 0);
+        finish_map(e);
     }
 }
 
 
-static void enc_auth(mpack_writer_t *w, const struct wrp_auth_msg *a)
+static void enc_auth(struct enc *e, const struct wrp_auth_msg *a)
 {
-    mpack_start_map(w, 2);
-    enc_mtype(w, WRP_MSG_TYPE__AUTH);
-    enc_int__(w, REQUIRED, &WRP_STATUS__, &a->status);
-    mpack_finish_map(w);
+    start_msg(e, 2);
+    enc_mtype(e, WRP_MSG_TYPE__AUTH);
+    enc_int__(e, REQUIRED, &WRP_STATUS__, &a->status);
+    finish_msg(e);
 }
 
 
-static void enc_req(mpack_writer_t *w, const struct wrp_req_msg *req)
+static void enc_req(struct enc *e, const struct wrp_req_msg *req)
 {
     /* Required:
      *   msg_type
@@ -165,27 +534,27 @@ static void enc_req(mpack_writer_t *w, const struct wrp_req_msg *req)
     count += (req->session_id.len) ? 1 : 0;
     count += (req->status.num) ? 1 : 0;
 
-    mpack_start_map(w, count);
-    enc_mtype(w, WRP_MSG_TYPE__REQ);
-    enc_str__(w, REQUIRED, &WRP_DEST____, &req->dest);
-    enc_blob_(w, REQUIRED, &WRP_PAYLOAD_, &req->payload);
-    enc_str__(w, REQUIRED, &WRP_SOURCE__, &req->source);
-    enc_str__(w, REQUIRED, &WRP_TRANS_ID, &req->trans_id);
+    start_msg(e, (uint32_t) count);
+    enc_mtype(e, WRP_MSG_TYPE__REQ);
+    enc_str__(e, REQUIRED, &WRP_DEST____, &req->dest);
+    enc_blob_(e, REQUIRED, &WRP_PAYLOAD_, &req->payload);
+    enc_str__(e, REQUIRED, &WRP_SOURCE__, &req->source);
+    enc_str__(e, REQUIRED, &WRP_TRANS_ID, &req->trans_id);
 
-    enc_str__(w, OPTIONAL, &WRP_ACCEPT__, &req->accept);
-    enc_str__(w, OPTIONAL, &WRP_CT______, &req->content_type);
-    enc_slist(w, OPTIONAL, &WRP_HEADERS_, &req->headers);
-    enc_nvpl_(w, OPTIONAL, &WRP_METADATA, &req->metadata);
-    enc_str__(w, OPTIONAL, &WRP_MSG_ID__, &req->msg_id);
-    enc_slist(w, OPTIONAL, &WRP_PARTNERS, &req->partner_ids);
-    enc_int__(w, OPTIONAL, &WRP_RDR_____, &req->rdr);
-    enc_str__(w, OPTIONAL, &WRP_SESS_ID_, &req->session_id);
-    enc_int__(w, OPTIONAL, &WRP_STATUS__, &req->status);
-    mpack_finish_map(w);
+    enc_str__(e, OPTIONAL, &WRP_ACCEPT__, &req->accept);
+    enc_str__(e, OPTIONAL, &WRP_CT______, &req->content_type);
+    enc_slist(e, OPTIONAL, &WRP_HEADERS_, &req->headers);
+    enc_nvpl_(e, OPTIONAL, &WRP_METADATA, &req->metadata);
+    enc_str__(e, OPTIONAL, &WRP_MSG_ID__, &req->msg_id);
+    enc_slist(e, OPTIONAL, &WRP_PARTNERS, &req->partner_ids);
+    enc_int__(e, OPTIONAL, &WRP_RDR_____, &req->rdr);
+    enc_str__(e, OPTIONAL, &WRP_SESS_ID_, &req->session_id);
+    enc_int__(e, OPTIONAL, &WRP_STATUS__, &req->status);
+    finish_msg(e);
 }
 
 
-static void enc_event(mpack_writer_t *w, const struct wrp_event_msg *event)
+static void enc_event(struct enc *e, const struct wrp_event_msg *event)
 {
     /* Required:
      *   msg_type
@@ -202,22 +571,22 @@ static void enc_event(mpack_writer_t *w, const struct wrp_event_msg *event)
     count += (event->msg_id.len) ? 1 : 0;
     count += (event->session_id.len) ? 1 : 0;
 
-    mpack_start_map(w, count);
-    enc_mtype(w, WRP_MSG_TYPE__EVENT);
-    enc_str__(w, REQUIRED, &WRP_DEST____, &event->dest);
-    enc_str__(w, REQUIRED, &WRP_SOURCE__, &event->source);
-    enc_str__(w, OPTIONAL, &WRP_CT______, &event->content_type);
-    enc_slist(w, OPTIONAL, &WRP_HEADERS_, &event->headers);
-    enc_nvpl_(w, OPTIONAL, &WRP_METADATA, &event->metadata);
-    enc_str__(w, OPTIONAL, &WRP_MSG_ID__, &event->msg_id);
-    enc_slist(w, OPTIONAL, &WRP_PARTNERS, &event->partner_ids);
-    enc_blob_(w, OPTIONAL, &WRP_PAYLOAD_, &event->payload);
-    enc_str__(w, OPTIONAL, &WRP_SESS_ID_, &event->session_id);
-    mpack_finish_map(w);
+    start_msg(e, (uint32_t) count);
+    enc_mtype(e, WRP_MSG_TYPE__EVENT);
+    enc_str__(e, REQUIRED, &WRP_DEST____, &event->dest);
+    enc_str__(e, REQUIRED, &WRP_SOURCE__, &event->source);
+    enc_str__(e, OPTIONAL, &WRP_CT______, &event->content_type);
+    enc_slist(e, OPTIONAL, &WRP_HEADERS_, &event->headers);
+    enc_nvpl_(e, OPTIONAL, &WRP_METADATA, &event->metadata);
+    enc_str__(e, OPTIONAL, &WRP_MSG_ID__, &event->msg_id);
+    enc_slist(e, OPTIONAL, &WRP_PARTNERS, &event->partner_ids);
+    enc_blob_(e, OPTIONAL, &WRP_PAYLOAD_, &event->payload);
+    enc_str__(e, OPTIONAL, &WRP_SESS_ID_, &event->session_id);
+    finish_msg(e);
 }
 
 
-static void enc_crud(mpack_writer_t *w, const struct wrp_crud_msg *crud,
+static void enc_crud(struct enc *e, const struct wrp_crud_msg *crud,
                      enum wrp_msg_type msg_type)
 {
     /* Required:
@@ -240,108 +609,444 @@ static void enc_crud(mpack_writer_t *w, const struct wrp_crud_msg *crud,
     count += (crud->session_id.len) ? 1 : 0;
     count += (crud->status.num) ? 1 : 0;
 
-    mpack_start_map(w, count);
-    enc_mtype(w, msg_type);
-    enc_str__(w, REQUIRED, &WRP_DEST____, &crud->dest);
-    enc_str__(w, REQUIRED, &WRP_SOURCE__, &crud->source);
-    enc_str__(w, REQUIRED, &WRP_TRANS_ID, &crud->trans_id);
-    enc_str__(w, OPTIONAL, &WRP_ACCEPT__, &crud->accept);
-    enc_str__(w, OPTIONAL, &WRP_CT______, &crud->content_type);
-    enc_slist(w, OPTIONAL, &WRP_HEADERS_, &crud->headers);
-    enc_nvpl_(w, OPTIONAL, &WRP_METADATA, &crud->metadata);
-    enc_str__(w, OPTIONAL, &WRP_MSG_ID__, &crud->msg_id);
-    enc_slist(w, OPTIONAL, &WRP_PARTNERS, &crud->partner_ids);
-    enc_str__(w, OPTIONAL, &WRP_PATH____, &crud->path);
-    enc_blob_(w, OPTIONAL, &WRP_PAYLOAD_, &crud->payload);
-    enc_int__(w, OPTIONAL, &WRP_RDR_____, &crud->rdr);
-    enc_str__(w, OPTIONAL, &WRP_SESS_ID_, &crud->session_id);
-    enc_int__(w, OPTIONAL, &WRP_STATUS__, &crud->status);
-    mpack_finish_map(w);
+    start_msg(e, (uint32_t) count);
+    enc_mtype(e, msg_type);
+    enc_str__(e, REQUIRED, &WRP_DEST____, &crud->dest);
+    enc_str__(e, REQUIRED, &WRP_SOURCE__, &crud->source);
+    enc_str__(e, REQUIRED, &WRP_TRANS_ID, &crud->trans_id);
+    enc_str__(e, OPTIONAL, &WRP_ACCEPT__, &crud->accept);
+    enc_str__(e, OPTIONAL, &WRP_CT______, &crud->content_type);
+    enc_slist(e, OPTIONAL, &WRP_HEADERS_, &crud->headers);
+    enc_nvpl_(e, OPTIONAL, &WRP_METADATA, &crud->metadata);
+    enc_str__(e, OPTIONAL, &WRP_MSG_ID__, &crud->msg_id);
+    enc_slist(e, OPTIONAL, &WRP_PARTNERS, &crud->partner_ids);
+    enc_str__(e, OPTIONAL, &WRP_PATH____, &crud->path);
+    enc_blob_(e, OPTIONAL, &WRP_PAYLOAD_, &crud->payload);
+    enc_int__(e, OPTIONAL, &WRP_RDR_____, &crud->rdr);
+    enc_str__(e, OPTIONAL, &WRP_SESS_ID_, &crud->session_id);
+    enc_int__(e, OPTIONAL, &WRP_STATUS__, &crud->status);
+    finish_msg(e);
 }
 
 
-static void enc_svc_reg(mpack_writer_t *w, const struct wrp_svc_reg_msg *r)
+static void enc_svc_reg(struct enc *e, const struct wrp_svc_reg_msg *r)
 {
-    mpack_start_map(w, 3);
-    enc_mtype(w, WRP_MSG_TYPE__SVC_REG);
-    enc_str__(w, REQUIRED, &WRP_SN______, &r->service_name);
-    enc_str__(w, REQUIRED, &WRP_URL_____, &r->url);
-    mpack_finish_map(w);
+    start_msg(e, 3);
+    enc_mtype(e, WRP_MSG_TYPE__SVC_REG);
+    enc_str__(e, REQUIRED, &WRP_SN______, &r->service_name);
+    enc_str__(e, REQUIRED, &WRP_URL_____, &r->url);
+    finish_msg(e);
 }
 
 
-static void enc_svc_alive(mpack_writer_t *w)
+static void enc_svc_alive(struct enc *e)
 {
-    mpack_start_map(w, 1);
-    enc_mtype(w, WRP_MSG_TYPE__SVC_ALIVE);
-    mpack_finish_map(w);
+    start_msg(e, 1);
+    enc_mtype(e, WRP_MSG_TYPE__SVC_ALIVE);
+    finish_msg(e);
 }
 
-/*----------------------------------------------------------------------------*/
-/*                             External Functions                             */
-/*----------------------------------------------------------------------------*/
-WRPcode wrp_to_msgpack(const wrp_msg_t *msg, uint8_t **buf, size_t *len)
-{
-    mpack_writer_t writer;
-    WRPcode rv = WRPE_OK;
-
-    if (!msg || !buf || !len) {
-        return WRPE_INVALID_ARGS;
-    }
-
-    if (*buf) {
-        mpack_writer_init(&writer, (char *) *buf, *len);
-    } else {
-        mpack_writer_init_growable(&writer, (char **) buf, len);
-    }
 
+static WRPcode enc_msg(struct enc *e, const wrp_msg_t *msg)
+{
     switch (msg->msg_type) {
         case WRP_MSG_TYPE__AUTH:
-            enc_auth(&writer, &msg->u.auth);
+            enc_auth(e, &msg->u.auth);
             break;
 
         case WRP_MSG_TYPE__REQ:
-            enc_req(&writer, &msg->u.req);
+            enc_req(e, &msg->u.req);
             break;
 
         case WRP_MSG_TYPE__EVENT:
-            enc_event(&writer, &msg->u.event);
+            enc_event(e, &msg->u.event);
             break;
 
         case WRP_MSG_TYPE__SVC_REG:
-            enc_svc_reg(&writer, &msg->u.reg);
+            enc_svc_reg(e, &msg->u.reg);
             break;
 
         case WRP_MSG_TYPE__CREATE:
         case WRP_MSG_TYPE__RETRIEVE:
         case WRP_MSG_TYPE__UPDATE:
         case WRP_MSG_TYPE__DELETE:
-            enc_crud(&writer, &msg->u.crud, msg->msg_type);
+            enc_crud(e, &msg->u.crud, msg->msg_type);
             break;
 
         case WRP_MSG_TYPE__SVC_ALIVE:
-            enc_svc_alive(&writer);
+            enc_svc_alive(e);
             break;
 
         default:
-            rv = WRPE_NOT_A_WRP_MSG;
-            break;
+            return WRPE_NOT_A_WRP_MSG;
     }
 
-    if (WRPE_OK == rv) {
-        mpack_error_t err;
+    return WRPE_OK;
+}
 
-        err = mpack_writer_error(&writer);
 
-        rv = map_mpack_err(err);
+static int cmp_str(const struct wrp_string *a, const struct wrp_string *b)
+{
+    size_t len = (a->len < b->len) ? a->len : b->len;
+    int rv     = len ? memcmp(a->s, b->s, len) : 0;
+
+    if (rv) {
+        return rv;
     }
 
-    if (WRPE_OK == rv) {
-        /* Set the buffer used to exactly that size vs. what might have
-         * been allocated extra. */
-        *len = mpack_writer_buffer_used(&writer);
+    return (a->len < b->len) ? -1 : (b->len < a->len) ? 1 : 0;
+}
+
+
+/* Orders by name, then by value, so equal lists always sort the same way. */
+static int cmp_nvp(const void *a, const void *b)
+{
+    const struct wrp_nvp *x = (const struct wrp_nvp *) a;
+    const struct wrp_nvp *y = (const struct wrp_nvp *) b;
+    int rv                  = cmp_str(&x->name, &y->name);
+
+    return rv ? rv : cmp_str(&x->value, &y->value);
+}
+
+
+static void on_flush(mpack_writer_t *w, const char *data, size_t len)
+{
+    struct flush *f = (struct flush *) mpack_writer_context(w);
+
+    f->rv = f->fn(f->ctx, data, len);
+    if (WRPE_OK != f->rv) {
+        /* Stops any more writes or flushes. */
+        mpack_writer_flag_error(w, mpack_error_io);
     }
+}
+
+
+/* Sizes the message, then writes it directly into a buffer of at least that
+ * size, so no bounds checks are needed while writing. */
+static WRPcode encode(struct enc *e, const wrp_msg_t *msg, uint8_t **buf, size_t *len)
+{
+    WRPcode rv;
+
+    rv = enc_msg(e, msg);
+    if (WRPE_OK != rv) {
+        return rv;
+    }
+
+    if (e->tmpl) {
+        e->pairs = e->tmpl->keys + e->keys;
+        e->len += container_hdr((uint32_t) e->pairs);
+    }
+
+    if (*buf) {
+        if (*len < e->len) {
+            return WRPE_MSG_TOO_BIG;
+        }
+        e->start = *buf;
+    } else {
+        /* The exact size is known, so the buffer is allocated only once. */
+        e->start = malloc(e->len);
+        if (!e->start) {
+            return WRPE_OUT_OF_MEMORY;
+        }
+    }
+
+    e->next  = e->start;
+    e->len   = 0;
+    e->ncuts = 0;
+    e->run   = 0;
+    e->keys  = 0;
+    enc_msg(e, msg);
+
+    *buf = e->start;
+    *len = e->len;
+
+    return WRPE_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+size_t wrp_msgpack_size(const wrp_msg_t *msg)
+{
+    struct enc e;
+
+    memset(&e, 0, sizeof(e));
+    if (!msg || (WRPE_OK != enc_msg(&e, msg))) {
+        return 0;
+    }
+
+    return e.len;
+}
+
+
+WRPcode wrp_to_msgpack(const wrp_msg_t *msg, uint8_t **buf, size_t *len)
+{
+    struct enc e;
+
+    if (!msg || !buf || !len) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    memset(&e, 0, sizeof(e));
+
+    return encode(&e, msg, buf, len);
+}
+
+
+WRPcode wrp_to_msgpack_canonical(const wrp_msg_t *msg, uint8_t **buf, size_t *len)
+{
+    struct wrp_nvp *sorted = NULL;
+    struct wrp_nvp_list *l;
+    wrp_msg_t tmp;
+    struct enc e;
+    WRPcode rv;
+
+    if (!msg || !buf || !len) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    /* The key order and the sizes are already fixed by the encoder, only the
+     * metadata order is up to the caller. */
+    tmp = *msg;
+    l   = (struct wrp_nvp_list *) metadata_of(&tmp); /* Points into tmp. */
+    if (l && l->list && (1 < l->count)) {
+        sorted = malloc(l->count * sizeof(struct wrp_nvp));
+        if (!sorted) {
+            return WRPE_OUT_OF_MEMORY;
+        }
+        memcpy(sorted, l->list, l->count * sizeof(struct wrp_nvp));
+        qsort(sorted, l->count, sizeof(struct wrp_nvp), cmp_nvp);
+        l->list = sorted;
+    }
+
+    memset(&e, 0, sizeof(e));
+    rv = encode(&e, &tmp, buf, len);
+
+    free(sorted);
 
-    mpack_writer_destroy(&writer);
     return rv;
 }
+
+
+WRPcode wrp_to_msgpack_iov(const wrp_msg_t *msg, uint8_t **buf, size_t *len,
+                           struct iovec *iov, int *iovcnt)
+{
+    struct enc e;
+    WRPcode rv;
+    int count = 0;
+
+    if (!msg || !buf || !len || !iov || !iovcnt) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    memset(&e, 0, sizeof(e));
+    e.iov = true;
+
+    rv = encode(&e, msg, buf, len);
+    if (WRPE_OK != rv) {
+        return rv;
+    }
+
+    if (!e.payload_len) {
+        e.at = *len;
+    }
+
+    iov[count].iov_base = *buf;
+    iov[count].iov_len  = e.at;
+    count++;
+
+    if (e.payload_len) {
+        iov[count].iov_base = (void *) e.payload;
+        iov[count].iov_len  = e.payload_len;
+        count++;
+    }
+
+    if (e.at < *len) {
+        iov[count].iov_base = &(*buf)[e.at];
+        iov[count].iov_len  = *len - e.at;
+        count++;
+    }
+
+    *iovcnt = count;
+
+    return WRPE_OK;
+}
+
+
+WRPcode wrp_to_msgpack_flush(const wrp_msg_t *msg, void *buf, size_t len,
+                             wrp_flush_fn fn, void *ctx)
+{
+    mpack_writer_t writer;
+    struct flush f;
+    struct enc e;
+    mpack_error_t err;
+    WRPcode rv;
+
+    if (!msg || !buf || (len < MPACK_WRITER_MINIMUM_BUFFER_SIZE) || !fn) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    f.fn  = fn;
+    f.ctx = ctx;
+    f.rv  = WRPE_OK;
+
+    /* The buffer only stages the small writes, anything larger than it (like
+     * the payload) is passed to the callback directly. */
+    mpack_writer_init(&writer, (char *) buf, len);
+    mpack_writer_set_context(&writer, &f);
+    mpack_writer_set_flush(&writer, on_flush);
+
+    memset(&e, 0, sizeof(e));
+    e.w = &writer;
+
+    rv = enc_msg(&e, msg);
+    if (WRPE_OK != rv) {
+        /* Keep whatever is staged from being flushed. */
+        mpack_writer_flag_error(&writer, mpack_error_data);
+    }
+
+    /* Flushes whatever is left in the buffer. */
+    err = mpack_writer_destroy(&writer);
+
+    if (WRPE_OK != rv) {
+        return rv;
+    }
+    if (WRPE_OK != f.rv) {
+        return f.rv;
+    }
+
+    return map_mpack_err(err);
+}
+
+
+WRPcode wrp_to_msgpack_batch(const wrp_msg_t *const *msgs, size_t count,
+                             enum wrp_framing framing, uint8_t **buf, size_t *len)
+{
+    size_t prefix = (WRP_FRAMING__LEN32 == framing) ? LEN32_PREFIX : 0;
+    size_t total  = 0;
+    uint8_t *next;
+    struct enc e;
+
+    if ((!msgs && count) || !buf || !len
+        || ((WRP_FRAMING__NONE != framing) && (WRP_FRAMING__LEN32 != framing)))
+    {
+        return WRPE_INVALID_ARGS;
+    }
+
+    /* Size the whole batch first so it is written in one buffer. */
+    for (size_t i = 0; i < count; i++) {
+        if (!msgs[i]) {
+            return WRPE_INVALID_ARGS;
+        }
+
+        memset(&e, 0, sizeof(e));
+        if (WRPE_OK != enc_msg(&e, msgs[i])) {
+            return WRPE_NOT_A_WRP_MSG;
+        }
+        if (prefix && (UINT32_MAX < e.len)) {
+            return WRPE_MSG_TOO_BIG;
+        }
+        total += prefix + e.len;
+    }
+
+    if (*buf) {
+        if (*len < total) {
+            return WRPE_MSG_TOO_BIG;
+        }
+        next = *buf;
+    } else {
+        /* Always allocate something, even for an empty batch. */
+        next = malloc(total ? total : 1);
+        if (!next) {
+            return WRPE_OUT_OF_MEMORY;
+        }
+        *buf = next;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        memset(&e, 0, sizeof(e));
+        e.start = &next[prefix];
+        e.next  = e.start;
+        enc_msg(&e, msgs[i]);
+
+        if (prefix) {
+            next[0] = (uint8_t) (e.len >> 24);
+            next[1] = (uint8_t) (e.len >> 16);
+            next[2] = (uint8_t) (e.len >> 8);
+            next[3] = (uint8_t) e.len;
+        }
+        next = e.next;
+    }
+
+    *len = total;
+
+    return WRPE_OK;
+}
+
+
+WRPcode wrp_template_create(wrp_template_t **tmpl, const wrp_msg_t *proto,
+                            uint32_t vary)
+{
+    wrp_template_t *t;
+    struct enc e;
+    uint8_t *bytes = NULL;
+    size_t len     = 0;
+    WRPcode rv;
+
+    if (!tmpl || !proto || !vary || (vary & ~WRP_FIELDS_ALL)
+        || (vary & WRP_FIELD_BIT(WRP_FIELD__MSG_TYPE)))
+    {
+        return WRPE_INVALID_ARGS;
+    }
+
+    t = calloc(1, sizeof(wrp_template_t));
+    if (!t) {
+        return WRPE_OUT_OF_MEMORY;
+    }
+
+    memset(&e, 0, sizeof(e));
+    e.vary = vary;
+    e.cuts = t->cuts;
+
+    rv = encode(&e, proto, &bytes, &len);
+    if (WRPE_OK != rv) {
+        free(t);
+        return rv;
+    }
+
+    t->msg_type = proto->msg_type;
+    t->vary     = vary;
+    t->keys     = e.keys;
+    t->ncuts    = e.ncuts;
+    t->bytes    = bytes;
+
+    *tmpl = t;
+
+    return WRPE_OK;
+}
+
+
+WRPcode wrp_template_encode(const wrp_template_t *tmpl, const wrp_msg_t *msg,
+                            uint8_t **buf, size_t *len)
+{
+    struct enc e;
+
+    if (!tmpl || !msg || !buf || !len || (tmpl->msg_type != msg->msg_type)) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    memset(&e, 0, sizeof(e));
+    e.vary = tmpl->vary;
+    e.tmpl = tmpl;
+
+    return encode(&e, msg, buf, len);
+}
+
+
+void wrp_template_destroy(wrp_template_t *tmpl)
+{
+    if (tmpl) {
+        free(tmpl->bytes);
+        free(tmpl);
+    }
+}
@@ -0,0 +1,149 @@
+/* SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "internal.h"
+
+/*----------------------------------------------------------------------------*/
+/*                                   Macros                                   */
+/*----------------------------------------------------------------------------*/
+/* none */
+
+/*----------------------------------------------------------------------------*/
+/*                               Data Structures                              */
+/*----------------------------------------------------------------------------*/
+
+/* How to find the size of a msgpack object from its first byte. */
+struct format {
+    uint8_t header;   /* The header length, including the first byte.    */
+    uint8_t count;    /* The length of the big endian count that follows
+                       * the first byte, or 0 if there is none.           */
+    uint8_t fixed;    /* The number of bytes that always follow the header. */
+    uint8_t children; /* 0: count is bytes, 1: array items, 2: map items.  */
+};
+
+/*----------------------------------------------------------------------------*/
+/*                            File Scoped Variables                           */
+/*----------------------------------------------------------------------------*/
+
+// clang-format off
+/* The formats for 0xc0 to 0xdf, the rest are in the fixed ranges. */
+static const struct format formats[32] = {
+    { 1, 0,  0, 0 }, /* 0xc0 nil      */
+    { 0, 0,  0, 0 }, /* 0xc1 invalid  */
+    { 1, 0,  0, 0 }, /* 0xc2 false    */
+    { 1, 0,  0, 0 }, /* 0xc3 true     */
+    { 2, 1,  0, 0 }, /* 0xc4 bin 8    */
+    { 3, 2,  0, 0 }, /* 0xc5 bin 16   */
+    { 5, 4,  0, 0 }, /* 0xc6 bin 32   */
+    { 3, 1,  0, 0 }, /* 0xc7 ext 8    */
+    { 4, 2,  0, 0 }, /* 0xc8 ext 16   */
+    { 6, 4,  0, 0 }, /* 0xc9 ext 32   */
+    { 1, 0,  4, 0 }, /* 0xca float 32 */
+    { 1, 0,  8, 0 }, /* 0xcb float 64 */
+    { 1, 0,  1, 0 }, /* 0xcc uint 8   */
+    { 1, 0,  2, 0 }, /* 0xcd uint 16  */
+    { 1, 0,  4, 0 }, /* 0xce uint 32  */
+    { 1, 0,  8, 0 }, /* 0xcf uint 64  */
+    { 1, 0,  1, 0 }, /* 0xd0 int 8    */
+    { 1, 0,  2, 0 }, /* 0xd1 int 16   */
+    { 1, 0,  4, 0 }, /* 0xd2 int 32   */
+    { 1, 0,  8, 0 }, /* 0xd3 int 64   */
+    { 2, 0,  1, 0 }, /* 0xd4 fixext 1 */
+    { 2, 0,  2, 0 }, /* 0xd5 fixext 2 */
+    { 2, 0,  4, 0 }, /* 0xd6 fixext 4 */
+    { 2, 0,  8, 0 }, /* 0xd7 fixext 8 */
+    { 2, 0, 16, 0 }, /* 0xd8 fixext16 */
+    { 2, 1,  0, 0 }, /* 0xd9 str 8    */
+    { 3, 2,  0, 0 }, /* 0xda str 16   */
+    { 5, 4,  0, 0 }, /* 0xdb str 32   */
+    { 3, 2,  0, 1 }, /* 0xdc array 16 */
+    { 5, 4,  0, 1 }, /* 0xdd array 32 */
+    { 3, 2,  0, 2 }, /* 0xde map 16   */
+    { 5, 4,  0, 2 }, /* 0xdf map 32   */
+};
+// clang-format on
+
+/*----------------------------------------------------------------------------*/
+/*                             Internal functions                             */
+/*----------------------------------------------------------------------------*/
+static void get_format(uint8_t b, struct format *f, size_t *n)
+{
+    *n = 0;
+
+    if (b <= 0x7f || 0xe0 <= b) {
+        *f = (struct format) { 1, 0, 0, 0 };
+    } else if (b <= 0x8f) {
+        *f = (struct format) { 1, 0, 0, 2 };
+        *n = b & 0x0f;
+    } else if (b <= 0x9f) {
+        *f = (struct format) { 1, 0, 0, 1 };
+        *n = b & 0x0f;
+    } else if (b <= 0xbf) {
+        *f = (struct format) { 1, 0, 0, 0 };
+        *n = b & 0x1f;
+    } else {
+        *f = formats[b - 0xc0];
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+enum frame_status frame_scan(struct frame_scanner *sc, const uint8_t *data,
+                             size_t len, size_t *used)
+{
+    size_t i = 0;
+
+    if (!sc->objects && !sc->skip) {
+        sc->objects = 1;
+    }
+
+    while (sc->objects || sc->skip) {
+        struct format f;
+        size_t n;
+
+        if (sc->skip) {
+            n = ((len - i) < sc->skip) ? (len - i) : sc->skip;
+            i += n;
+            sc->skip -= n;
+            if (sc->skip) {
+                break;
+            }
+            continue;
+        }
+
+        if (i == len) {
+            break;
+        }
+
+        get_format(data[i], &f, &n);
+        if (!f.header) {
+            *used = i;
+            return FRAME__INVALID;
+        }
+
+        /* Wait for the whole header before consuming any of it. */
+        if ((len - i) < f.header) {
+            break;
+        }
+
+        for (size_t j = 1; j <= f.count; j++) {
+            n = (n << 8) | data[i + j];
+        }
+        i += f.header;
+        sc->objects--;
+
+        if (f.children) {
+            sc->objects += n * f.children;
+        } else {
+            sc->skip = n + f.fixed;
+        }
+    }
+
+    *used = i;
+
+    return (sc->objects || sc->skip) ? FRAME__MORE : FRAME__DONE;
+}
@@ -0,0 +1,294 @@
+/* SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "internal.h"
+#include "wrp-c.h"
+
+/*----------------------------------------------------------------------------*/
+/*                                   Macros                                   */
+/*----------------------------------------------------------------------------*/
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME  16777619u
+
+/*----------------------------------------------------------------------------*/
+/*                             Internal functions                             */
+/*----------------------------------------------------------------------------*/
+/* Only ASCII is folded, which is all a header name may contain. */
+static uint8_t fold(char c)
+{
+    return (('A' <= c) && (c <= 'Z')) ? (uint8_t) (c - 'A' + 'a') : (uint8_t) c;
+}
+
+
+static uint32_t hash(const char *s, size_t len, bool nocase)
+{
+    uint32_t h = FNV_OFFSET;
+
+    for (size_t i = 0; i < len; i++) {
+        h ^= nocase ? fold(s[i]) : (uint8_t) s[i];
+        h *= FNV_PRIME;
+    }
+
+    return h;
+}
+
+
+static bool is_name(const struct wrp_string *s, const char *name, size_t len, bool nocase)
+{
+    if (s->len != len) {
+        return false;
+    }
+
+    if (!nocase) {
+        return !len || (0 == memcmp(s->s, name, len));
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        if (fold(s->s[i]) != fold(name[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+static bool is_space(char c)
+{
+    return (' ' == c) || ('\t' == c);
+}
+
+
+static void trim(const char *s, size_t len, struct wrp_string *out)
+{
+    while (len && is_space(*s)) {
+        s++;
+        len--;
+    }
+    while (len && is_space(s[len - 1])) {
+        len--;
+    }
+
+    out->s   = len ? s : NULL;
+    out->len = len;
+}
+
+
+static bool split(const struct wrp_string *header, struct wrp_nvp *nvp)
+{
+    const char *colon = NULL;
+
+    if (header->len) {
+        colon = memchr(header->s, ':', header->len);
+    }
+    if (!colon) {
+        return false;
+    }
+
+    trim(header->s, (size_t) (colon - header->s), &nvp->name);
+    trim(&colon[1], header->len - (size_t) (colon - header->s) - 1, &nvp->value);
+
+    return true;
+}
+
+
+static const struct wrp_nvp *index_find(const struct wrp_index *idx, const char *name,
+                                        size_t len)
+{
+    size_t at = hash(name, len, idx->nocase) & idx->mask;
+
+    while (idx->slots[at]) {
+        const struct wrp_nvp *nvp = &idx->list[idx->slots[at] - 1];
+
+        if (is_name(&nvp->name, name, len, idx->nocase)) {
+            return nvp;
+        }
+        at = (at + 1) & idx->mask;
+    }
+
+    return NULL;
+}
+
+
+static const struct wrp_internal *get_internal(const wrp_msg_t *msg)
+{
+    const struct wrp_internal *p = (const struct wrp_internal *) msg->__internal_only;
+
+    /* A copy of the message points at the original's storage, so only the
+     * message itself may use it. */
+    if (!p || (INTERNAL_SIGNATURE != p->sig) || (&p->msg != msg)) {
+        return NULL;
+    }
+
+    return p;
+}
+
+
+/* Returns if the index was built over the list the message has now. */
+static bool is_current(const struct wrp_index *idx, const void *list, size_t count)
+{
+    return idx->slots && (idx->of == list) && (idx->of_count == count);
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+size_t index_slots(size_t count)
+{
+    size_t slots = 1;
+
+    if (!count) {
+        return 0;
+    }
+
+    /* Keep the load at or below one half so probes stay short. */
+    while (slots < (2 * count)) {
+        slots *= 2;
+    }
+
+    return slots;
+}
+
+
+void index_build(struct wrp_index *idx, const struct wrp_nvp *list, size_t count,
+                 uint32_t *slots, size_t nslots, bool nocase)
+{
+    idx->list   = list;
+    idx->slots  = slots;
+    idx->mask   = nslots - 1;
+    idx->nocase = nocase;
+
+    /* Entries are added in order, so the first of any duplicates is found
+     * first when probing. */
+    for (size_t i = 0; i < count; i++) {
+        size_t at = hash(list[i].name.s, list[i].name.len, nocase) & idx->mask;
+
+        while (slots[at]) {
+            at = (at + 1) & idx->mask;
+        }
+        slots[at] = (uint32_t) (i + 1);
+    }
+}
+
+
+size_t split_headers(const struct wrp_string_list *l, struct wrp_nvp *out)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < l->count; i++) {
+        if (split(&l->list[i], &out[count])) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+
+const struct wrp_nvp_list *metadata_of(const wrp_msg_t *msg)
+{
+    switch (msg->msg_type) {
+        case WRP_MSG_TYPE__REQ:
+            return &msg->u.req.metadata;
+        case WRP_MSG_TYPE__EVENT:
+            return &msg->u.event.metadata;
+        case WRP_MSG_TYPE__CREATE:
+        case WRP_MSG_TYPE__RETRIEVE:
+        case WRP_MSG_TYPE__UPDATE:
+        case WRP_MSG_TYPE__DELETE:
+            return &msg->u.crud.metadata;
+        default:
+            break;
+    }
+
+    return NULL;
+}
+
+
+const struct wrp_string_list *headers_of(const wrp_msg_t *msg)
+{
+    switch (msg->msg_type) {
+        case WRP_MSG_TYPE__REQ:
+            return &msg->u.req.headers;
+        case WRP_MSG_TYPE__EVENT:
+            return &msg->u.event.headers;
+        case WRP_MSG_TYPE__CREATE:
+        case WRP_MSG_TYPE__RETRIEVE:
+        case WRP_MSG_TYPE__UPDATE:
+        case WRP_MSG_TYPE__DELETE:
+            return &msg->u.crud.headers;
+        default:
+            break;
+    }
+
+    return NULL;
+}
+
+
+const struct wrp_string *wrp_metadata_get(const wrp_msg_t *msg, const char *name,
+                                          size_t len)
+{
+    const struct wrp_nvp_list *l;
+    const struct wrp_internal *p;
+
+    if (!msg || (!name && len)) {
+        return NULL;
+    }
+
+    p = get_internal(msg);
+    l = metadata_of(msg);
+    if (p && l && is_current(&p->metadata, l->list, l->count)) {
+        const struct wrp_nvp *nvp = index_find(&p->metadata, name, len);
+
+        return nvp ? &nvp->value : NULL;
+    }
+
+    if (l) {
+        for (size_t i = 0; i < l->count; i++) {
+            if (is_name(&l->list[i].name, name, len, false)) {
+                return &l->list[i].value;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+bool wrp_header_get(const wrp_msg_t *msg, const char *name, size_t len,
+                    struct wrp_string *value)
+{
+    const struct wrp_string_list *l;
+    const struct wrp_internal *p;
+    struct wrp_nvp nvp;
+
+    if (!msg || (!name && len) || !value) {
+        return false;
+    }
+
+    p = get_internal(msg);
+    l = headers_of(msg);
+    if (p && l && is_current(&p->headers, l->list, l->count)) {
+        const struct wrp_nvp *found = index_find(&p->headers, name, len);
+
+        if (found) {
+            *value = found->value;
+        }
+        return (NULL != found);
+    }
+
+    if (l) {
+        for (size_t i = 0; i < l->count; i++) {
+            if (split(&l->list[i], &nvp) && is_name(&nvp.name, name, len, true)) {
+                *value = nvp.value;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
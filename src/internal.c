@@ -32,6 +32,24 @@
 /*----------------------------------------------------------------------------*/
 /*                             External Functions                             */
 /*----------------------------------------------------------------------------*/
+bool has_lists(enum wrp_msg_type type)
+{
+    switch (type) {
+        case WRP_MSG_TYPE__REQ:
+        case WRP_MSG_TYPE__EVENT:
+        case WRP_MSG_TYPE__CREATE:
+        case WRP_MSG_TYPE__RETRIEVE:
+        case WRP_MSG_TYPE__UPDATE:
+        case WRP_MSG_TYPE__DELETE:
+            return true;
+        default:
+            break;
+    }
+
+    return false;
+}
+
+
 WRPcode map_mpack_err(mpack_error_t err)
 {
     WRPcode rv = WRPE_OK;
@@ -66,3 +84,20 @@ WRPcode map_mpack_err(mpack_error_t err)
 
     return rv;
 }
+
+
+void *arena_take(void *arena, size_t arena_len, size_t size)
+{
+    const size_t align = ALIGNMENT_OF(struct wrp_internal);
+    size_t pad;
+
+    pad = (align - ((uintptr_t) arena % align)) % align;
+    if ((arena_len < pad) || ((arena_len - pad) < size)) {
+        return NULL;
+    }
+
+    arena = (uint8_t *) arena + pad;
+    memset(arena, 0, size);
+
+    return arena;
+}
@@ -4,6 +4,7 @@
 #ifndef __INTERNAL_H__
 #define __INTERNAL_H__
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -18,25 +19,168 @@
 #define OPTIONAL           1
 #define INTERNAL_SIGNATURE 0x777270
 
+/* The alignment needed to place a type at an arbitrary address. */
+#define ALIGNMENT_OF(type) offsetof(struct { char c; type t; }, t)
+
+/* Rounds n up to the next multiple of a. */
+#define ALIGN_UP(n, a) ((((n) + (a) - 1) / (a)) * (a))
+
 /*----------------------------------------------------------------------------*/
 /*                               Data Structures                              */
 /*----------------------------------------------------------------------------*/
+/* An open addressed hash index over a list of name/value pairs. */
+struct wrp_index {
+    const struct wrp_nvp *list;
+    uint32_t *slots; /* The list index + 1 of each entry, 0 when empty. */
+    size_t mask;     /* The slot count is a power of 2, this is count - 1. */
+    bool nocase;     /* The names are compared without case. */
+
+    /* The message's list the index was built over, so a list that was
+     * replaced or changed size since isn't looked up with a stale index. */
+    const void *of;
+    size_t of_count;
+};
+
+
 struct wrp_internal {
     int sig;
-    mpack_tree_t tree;
+    bool external; /* The storage belongs to the caller, don't free it. */
 
-    /* The list of things to free */
-    void *partner_ids;
-    void *metadata;
-    void *headers;
+    /* Only built when asked for. */
+    struct wrp_index metadata;
+    struct wrp_index headers;
 
     wrp_msg_t msg;
 };
 
 
+/* The list storage that follows a message when it is placed in a single
+ * block of memory. */
+struct wrp_lists {
+    struct wrp_string *strings;
+    struct wrp_nvp *nvps;
+    uint32_t *slots;
+};
+
+
+/* The state of the search for the end of a msgpack object that may arrive in
+ * pieces.  A zeroed scanner is ready to start on a new object. */
+struct frame_scanner {
+    size_t objects; /* The objects left to find the header of. */
+    size_t skip;    /* The bytes left in the current object.    */
+};
+
+enum frame_status {
+    FRAME__MORE,
+    FRAME__DONE,
+    FRAME__INVALID,
+};
+
+
+/**
+ * Provides the zeroed storage for a message and the specified number of list
+ * entries and index slots.
+ */
+typedef mpack_error_t (*storage_fn)(void *ctx, size_t strings, size_t nvps,
+                                    size_t slots, struct wrp_internal **p,
+                                    struct wrp_lists *mem);
+
+
+/**
+ * Decodes a parsed tree into a message placed in the storage provided by fn.
+ * Only the optional fields in the fields mask are decoded.
+ *
+ * @note If a message is returned via out, it must be released even if an
+ *       error is returned.
+ */
+mpack_error_t decode_tree(mpack_tree_t *tree, uint32_t fields, storage_fn fn,
+                          void *ctx, struct wrp_internal **out);
+
+
+/**
+ * Returns the size of the storage the sequential reader needs to decode the
+ * message, or 0 if the message is not valid (the reason is in rv).
+ */
+size_t reader_msg_size(const void *data, size_t len, WRPcode *rv);
+
+
+/**
+ * Decodes the message with the sequential reader into zeroed storage of the
+ * size returned by reader_msg_size().  The storage is marked as external.
+ */
+WRPcode reader_place_msg(const void *data, size_t len, struct wrp_internal *p);
+
+
+/**
+ * Scans the data for the end of the current msgpack object.  The scan picks
+ * up where the last call left off, so the object may be fed in pieces.
+ *
+ * @param sc   the scanner state
+ * @param data the next bytes of the object
+ * @param len  the length of data
+ * @param used the number of bytes consumed, up to the end of the object when
+ *             FRAME__DONE is returned.  A partial header is not consumed and
+ *             must be passed again with the bytes that follow it.
+ *
+ * @return FRAME__DONE when the object is complete, FRAME__MORE if more data is
+ *         needed or FRAME__INVALID if the data is not msgpack
+ */
+enum frame_status frame_scan(struct frame_scanner *sc, const uint8_t *data,
+                             size_t len, size_t *used);
+
+
+/**
+ * Returns the number of index slots needed for a list of count entries.
+ */
+size_t index_slots(size_t count);
+
+
+/**
+ * Builds the index over the list using the zeroed slots.
+ */
+void index_build(struct wrp_index *idx, const struct wrp_nvp *list, size_t count,
+                 uint32_t *slots, size_t nslots, bool nocase);
+
+
+/**
+ * Splits the "Name: value" headers into name/value views.  Headers without a
+ * ':' are left out.
+ *
+ * @return the number of views placed in out
+ */
+size_t split_headers(const struct wrp_string_list *l, struct wrp_nvp *out);
+
+
+/**
+ * Returns the metadata list of the message, or NULL if the type has none.
+ */
+const struct wrp_nvp_list *metadata_of(const wrp_msg_t *msg);
+
+
+/**
+ * Returns the headers list of the message, or NULL if the type has none.
+ */
+const struct wrp_string_list *headers_of(const wrp_msg_t *msg);
+
+
+/**
+ * Returns if the message type has any lists.
+ */
+bool has_lists(enum wrp_msg_type type);
+
+
 /**
  * A simple map function for error codes.
  */
 WRPcode map_mpack_err(mpack_error_t err);
 
+
+/**
+ * Places a zeroed object of the specified size at the first suitably aligned
+ * address in the caller supplied buffer.
+ *
+ * @return the object or NULL if the buffer is too small
+ */
+void *arena_take(void *arena, size_t arena_len, size_t size);
+
 #endif
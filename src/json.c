@@ -0,0 +1,1418 @@
+/* SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "internal.h"
+#include "wrp-c.h"
+
+/*----------------------------------------------------------------------------*/
+/*                                   Macros                                   */
+/*----------------------------------------------------------------------------*/
+#define MIN_STAGING 32
+#define MAX_DEPTH   32
+
+/*----------------------------------------------------------------------------*/
+/*                               Data Structures                              */
+/*----------------------------------------------------------------------------*/
+
+/* Output either goes into the buffer while it fits (counting the full length
+ * like snprintf()), or is staged in the buffer and passed to fn in chunks. */
+struct out {
+    char *buf;
+    size_t size;
+    size_t used;
+    size_t len;
+
+    wrp_flush_fn fn;
+    void *ctx;
+    WRPcode rv;
+
+    enum wrp_json_payload payload;
+    bool first;
+};
+
+
+/* Where a value from the root object is in the text. */
+struct value {
+    const char *start;
+    const char *end;
+};
+
+struct values {
+    uint32_t found;
+    struct value v[WRP_FIELD__LAST];
+};
+
+
+/* The same walk over the values is used to size the message and then to
+ * place it. */
+struct slab {
+    bool place;
+    WRPcode rv;
+    enum wrp_json_payload payload;
+
+    /* Sizing */
+    size_t strings;
+    size_t nvps;
+    size_t bytes;
+
+    /* Placing */
+    struct wrp_lists mem;
+    char *next;
+};
+
+/*----------------------------------------------------------------------------*/
+/*                            File Scoped Variables                           */
+/*----------------------------------------------------------------------------*/
+static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char hex[] = "0123456789abcdef";
+
+/*----------------------------------------------------------------------------*/
+/*                             Internal functions                             */
+/*----------------------------------------------------------------------------*/
+static void flush(struct out *o, const char *data, size_t len)
+{
+    if ((WRPE_OK == o->rv) && len) {
+        o->rv = o->fn(o->ctx, data, len);
+    }
+}
+
+
+static void put(struct out *o, const char *s, size_t len)
+{
+    if (!len) {
+        return;
+    }
+
+    o->len += len;
+
+    if (!o->fn) {
+        if (o->used < o->size) {
+            size_t room = o->size - o->used;
+
+            memcpy(&o->buf[o->used], s, (len < room) ? len : room);
+        }
+        o->used += len;
+        return;
+    }
+
+    if ((o->size - o->used) < len) {
+        flush(o, o->buf, o->used);
+        o->used = 0;
+
+        /* Large writes skip the staging buffer. */
+        if (o->size < len) {
+            flush(o, s, len);
+            return;
+        }
+    }
+
+    memcpy(&o->buf[o->used], s, len);
+    o->used += len;
+}
+
+
+static void put_c(struct out *o, char c)
+{
+    put(o, &c, 1);
+}
+
+
+/* Returns the length of the valid UTF-8 sequence at s, or 0 if there isn't one. */
+static size_t utf8_len(const uint8_t *s, size_t len)
+{
+    uint8_t c = s[0];
+    uint32_t min;
+    uint32_t cp;
+    size_t n;
+
+    if (c < 0x80) {
+        return 1;
+    }
+
+    if ((c & 0xe0) == 0xc0) {
+        n   = 1;
+        min = 0x80;
+        cp  = c & 0x1f;
+    } else if ((c & 0xf0) == 0xe0) {
+        n   = 2;
+        min = 0x800;
+        cp  = c & 0x0f;
+    } else if ((c & 0xf8) == 0xf0) {
+        n   = 3;
+        min = 0x10000;
+        cp  = c & 0x07;
+    } else {
+        return 0;
+    }
+
+    if ((len - 1) < n) {
+        return 0;
+    }
+    for (size_t j = 1; j <= n; j++) {
+        if ((s[j] & 0xc0) != 0x80) {
+            return 0;
+        }
+        cp = (cp << 6) | (s[j] & 0x3f);
+    }
+
+    /* No overlong forms, surrogates or values past the last one. */
+    if ((cp < min) || ((0xd800 <= cp) && (cp <= 0xdfff)) || (0x10ffff < cp)) {
+        return 0;
+    }
+
+    return n + 1;
+}
+
+
+static bool is_utf8(const uint8_t *s, size_t len)
+{
+    size_t i = 0;
+
+    while (i < len) {
+        size_t n = utf8_len(&s[i], len - i);
+
+        if (!n) {
+            return false;
+        }
+        i += n;
+    }
+
+    return true;
+}
+
+
+/* Writes the string with the characters JSON doesn't allow escaped, and each
+ * byte that isn't part of valid UTF-8 replaced with U+FFFD. */
+static void put_escaped(struct out *o, const char *s, size_t len)
+{
+    size_t run = 0;
+
+    put_c(o, '"');
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = (uint8_t) s[i];
+        char esc[6];
+        size_t esc_len = 2;
+
+        if (0x80 <= c) {
+            size_t n = utf8_len((const uint8_t *) &s[i], len - i);
+
+            if (n) {
+                i += n - 1;
+                continue;
+            }
+
+            put(o, &s[run], i - run);
+            run = i + 1;
+            put(o, "\\ufffd", 6);
+            continue;
+        }
+
+        if ((0x20 <= c) && ('"' != c) && ('\\' != c)) {
+            continue;
+        }
+
+        put(o, &s[run], i - run);
+        run = i + 1;
+
+        esc[0] = '\\';
+        switch (c) {
+            case '"':
+            case '\\':
+                esc[1] = (char) c;
+                break;
+            case '\b':
+                esc[1] = 'b';
+                break;
+            case '\f':
+                esc[1] = 'f';
+                break;
+            case '\n':
+                esc[1] = 'n';
+                break;
+            case '\r':
+                esc[1] = 'r';
+                break;
+            case '\t':
+                esc[1] = 't';
+                break;
+            default:
+                esc[1]  = 'u';
+                esc[2]  = '0';
+                esc[3]  = '0';
+                esc[4]  = hex[c >> 4];
+                esc[5]  = hex[c & 0x0f];
+                esc_len = 6;
+                break;
+        }
+        put(o, esc, esc_len);
+    }
+
+    put(o, &s[run], len - run);
+    put_c(o, '"');
+}
+
+
+static void put_key(struct out *o, const struct wrp_token *token)
+{
+    if (!o->first) {
+        put_c(o, ',');
+    }
+    o->first = false;
+
+    put_c(o, '"');
+    put(o, token->s, token->len);
+    put(o, "\":", 2);
+}
+
+
+static void put_num(struct out *o, int num)
+{
+    char buf[16];
+    int len;
+
+    len = snprintf(buf, sizeof(buf), "%d", num);
+    put(o, buf, (size_t) len);
+}
+
+
+static void put_base64(struct out *o, const uint8_t *data, size_t len)
+{
+    char buf[64];
+    size_t used = 0;
+
+    put_c(o, '"');
+
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t) data[i] << 16;
+
+        if ((i + 1) < len) {
+            v |= (uint32_t) data[i + 1] << 8;
+        }
+        if ((i + 2) < len) {
+            v |= data[i + 2];
+        }
+
+        buf[used++] = b64[(v >> 18) & 0x3f];
+        buf[used++] = b64[(v >> 12) & 0x3f];
+        buf[used++] = ((i + 1) < len) ? b64[(v >> 6) & 0x3f] : '=';
+        buf[used++] = ((i + 2) < len) ? b64[v & 0x3f] : '=';
+
+        if (sizeof(buf) == used) {
+            put(o, buf, used);
+            used = 0;
+        }
+    }
+
+    put(o, buf, used);
+    put_c(o, '"');
+}
+
+
+static void json_str__(struct out *o, int flags, const struct wrp_token *token,
+                       const struct wrp_string *s)
+{
+    if (s->len || (REQUIRED == flags)) {
+        put_key(o, token);
+        put_escaped(o, s->s, s->len);
+    }
+}
+
+
+static void json_int__(struct out *o, int flags, const struct wrp_token *token,
+                       const struct wrp_int *i)
+{
+    if (i->num) {
+        put_key(o, token);
+        put_num(o, *i->num);
+    } else if (REQUIRED == flags) {
+        put_key(o, token);
+        put(o, "null", 4);
+    }
+}
+
+
+static void json_blob_(struct out *o, const struct wrp_blob *blob)
+{
+    if (!blob->len) {
+        return;
+    }
+
+    if (WRP_JSON_PAYLOAD__BASE64 == o->payload) {
+        put_key(o, &WRP_PAYLOAD_);
+        put_base64(o, blob->data, blob->len);
+    } else if ((WRP_JSON_PAYLOAD__UTF8 == o->payload) && is_utf8(blob->data, blob->len)) {
+        put_key(o, &WRP_PAYLOAD_);
+        put_escaped(o, (const char *) blob->data, blob->len);
+    }
+}
+
+
+static void json_slist(struct out *o, const struct wrp_token *token,
+                       const struct wrp_string_list *l)
+{
+    if (!l->count) {
+        return;
+    }
+
+    put_key(o, token);
+    put_c(o, '[');
+    for (size_t i = 0; i < l->count; i++) {
+        if (i) {
+            put_c(o, ',');
+        }
+        put_escaped(o, l->list[i].s, l->list[i].len);
+    }
+    put_c(o, ']');
+}
+
+
+static void json_nvpl_(struct out *o, const struct wrp_token *token,
+                       const struct wrp_nvp_list *l)
+{
+    if (!l->count) {
+        return;
+    }
+
+    put_key(o, token);
+    put_c(o, '{');
+    for (size_t i = 0; i < l->count; i++) {
+        if (i) {
+            put_c(o, ',');
+        }
+        put_escaped(o, l->list[i].name.s, l->list[i].name.len);
+        put_c(o, ':');
+        put_escaped(o, l->list[i].value.s, l->list[i].value.len);
+    }
+    put_c(o, '}');
+}
+
+
+/* The fields are in the same order as the msgpack encoding. */
+static WRPcode json_msg(struct out *o, const wrp_msg_t *msg)
+{
+    const struct wrp_req_msg *req     = &msg->u.req;
+    const struct wrp_event_msg *event = &msg->u.event;
+    const struct wrp_crud_msg *crud   = &msg->u.crud;
+
+    switch (msg->msg_type) {
+        case WRP_MSG_TYPE__AUTH:
+        case WRP_MSG_TYPE__REQ:
+        case WRP_MSG_TYPE__EVENT:
+        case WRP_MSG_TYPE__CREATE:
+        case WRP_MSG_TYPE__RETRIEVE:
+        case WRP_MSG_TYPE__UPDATE:
+        case WRP_MSG_TYPE__DELETE:
+        case WRP_MSG_TYPE__SVC_REG:
+        case WRP_MSG_TYPE__SVC_ALIVE:
+            break;
+        default:
+            return WRPE_NOT_A_WRP_MSG;
+    }
+
+    o->first = true;
+    put_c(o, '{');
+    put_key(o, &WRP_MSG_TYPE);
+    put_num(o, msg->msg_type);
+
+    switch (msg->msg_type) {
+        case WRP_MSG_TYPE__AUTH:
+            json_int__(o, REQUIRED, &WRP_STATUS__, &msg->u.auth.status);
+            break;
+
+        case WRP_MSG_TYPE__REQ:
+            json_str__(o, REQUIRED, &WRP_DEST____, &req->dest);
+            json_blob_(o, &req->payload);
+            json_str__(o, REQUIRED, &WRP_SOURCE__, &req->source);
+            json_str__(o, REQUIRED, &WRP_TRANS_ID, &req->trans_id);
+            json_str__(o, OPTIONAL, &WRP_ACCEPT__, &req->accept);
+            json_str__(o, OPTIONAL, &WRP_CT______, &req->content_type);
+            json_slist(o, &WRP_HEADERS_, &req->headers);
+            json_nvpl_(o, &WRP_METADATA, &req->metadata);
+            json_str__(o, OPTIONAL, &WRP_MSG_ID__, &req->msg_id);
+            json_slist(o, &WRP_PARTNERS, &req->partner_ids);
+            json_int__(o, OPTIONAL, &WRP_RDR_____, &req->rdr);
+            json_str__(o, OPTIONAL, &WRP_SESS_ID_, &req->session_id);
+            json_int__(o, OPTIONAL, &WRP_STATUS__, &req->status);
+            break;
+
+        case WRP_MSG_TYPE__EVENT:
+            json_str__(o, REQUIRED, &WRP_DEST____, &event->dest);
+            json_str__(o, REQUIRED, &WRP_SOURCE__, &event->source);
+            json_str__(o, OPTIONAL, &WRP_CT______, &event->content_type);
+            json_slist(o, &WRP_HEADERS_, &event->headers);
+            json_nvpl_(o, &WRP_METADATA, &event->metadata);
+            json_str__(o, OPTIONAL, &WRP_MSG_ID__, &event->msg_id);
+            json_slist(o, &WRP_PARTNERS, &event->partner_ids);
+            json_blob_(o, &event->payload);
+            json_str__(o, OPTIONAL, &WRP_SESS_ID_, &event->session_id);
+            break;
+
+        case WRP_MSG_TYPE__CREATE:
+        case WRP_MSG_TYPE__RETRIEVE:
+        case WRP_MSG_TYPE__UPDATE:
+        case WRP_MSG_TYPE__DELETE:
+            json_str__(o, REQUIRED, &WRP_DEST____, &crud->dest);
+            json_str__(o, REQUIRED, &WRP_SOURCE__, &crud->source);
+            json_str__(o, REQUIRED, &WRP_TRANS_ID, &crud->trans_id);
+            json_str__(o, OPTIONAL, &WRP_ACCEPT__, &crud->accept);
+            json_str__(o, OPTIONAL, &WRP_CT______, &crud->content_type);
+            json_slist(o, &WRP_HEADERS_, &crud->headers);
+            json_nvpl_(o, &WRP_METADATA, &crud->metadata);
+            json_str__(o, OPTIONAL, &WRP_MSG_ID__, &crud->msg_id);
+            json_slist(o, &WRP_PARTNERS, &crud->partner_ids);
+            json_str__(o, OPTIONAL, &WRP_PATH____, &crud->path);
+            json_blob_(o, &crud->payload);
+            json_int__(o, OPTIONAL, &WRP_RDR_____, &crud->rdr);
+            json_str__(o, OPTIONAL, &WRP_SESS_ID_, &crud->session_id);
+            json_int__(o, OPTIONAL, &WRP_STATUS__, &crud->status);
+            break;
+
+        case WRP_MSG_TYPE__SVC_REG:
+            json_str__(o, REQUIRED, &WRP_SN______, &msg->u.reg.service_name);
+            json_str__(o, REQUIRED, &WRP_URL_____, &msg->u.reg.url);
+            break;
+
+        default: /* WRP_MSG_TYPE__SVC_ALIVE */
+            break;
+    }
+
+    put_c(o, '}');
+
+    return WRPE_OK;
+}
+
+
+static bool is_digit(char c)
+{
+    return ('0' <= c) && (c <= '9');
+}
+
+
+static void skip_ws(const char **p, const char *end)
+{
+    while ((*p < end) && ((' ' == **p) || ('\t' == **p) || ('\n' == **p) || ('\r' == **p))) {
+        (*p)++;
+    }
+}
+
+
+static bool skip_char(const char **p, const char *end, char c)
+{
+    skip_ws(p, end);
+    if ((*p == end) || (c != **p)) {
+        return false;
+    }
+    (*p)++;
+
+    return true;
+}
+
+
+static int hex_val(char c)
+{
+    if (is_digit(c)) {
+        return c - '0';
+    }
+    if (('a' <= c) && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    if (('A' <= c) && (c <= 'F')) {
+        return c - 'A' + 10;
+    }
+
+    return -1;
+}
+
+
+static bool get_hex4(const char *p, const char *end, uint32_t *v)
+{
+    if ((end - p) < 4) {
+        return false;
+    }
+
+    *v = 0;
+    for (int i = 0; i < 4; i++) {
+        int h = hex_val(p[i]);
+
+        if (h < 0) {
+            return false;
+        }
+        *v = (*v << 4) | (uint32_t) h;
+    }
+
+    return true;
+}
+
+
+static int put_utf8(char *buf, uint32_t cp)
+{
+    if (cp < 0x80) {
+        buf[0] = (char) cp;
+        return 1;
+    }
+
+    if (cp < 0x800) {
+        buf[0] = (char) (0xc0 | (cp >> 6));
+        buf[1] = (char) (0x80 | (cp & 0x3f));
+        return 2;
+    }
+
+    if (cp < 0x10000) {
+        buf[0] = (char) (0xe0 | (cp >> 12));
+        buf[1] = (char) (0x80 | ((cp >> 6) & 0x3f));
+        buf[2] = (char) (0x80 | (cp & 0x3f));
+        return 3;
+    }
+
+    buf[0] = (char) (0xf0 | (cp >> 18));
+    buf[1] = (char) (0x80 | ((cp >> 12) & 0x3f));
+    buf[2] = (char) (0x80 | ((cp >> 6) & 0x3f));
+    buf[3] = (char) (0x80 | (cp & 0x3f));
+    return 4;
+}
+
+
+/* Reads the next character of a string into buf, returning the number of
+ * bytes it takes, 0 at the closing quote or -1 if the string is not valid. */
+static int next_char(const char **p, const char *end, char *buf)
+{
+    const char *s = *p;
+    uint32_t cp;
+    uint32_t lo;
+
+    if (s == end) {
+        return -1;
+    }
+
+    if ('"' == *s) {
+        *p = &s[1];
+        return 0;
+    }
+
+    if ((uint8_t) *s < 0x20) {
+        return -1;
+    }
+
+    if ('\\' != *s) {
+        buf[0] = *s;
+        *p     = &s[1];
+        return 1;
+    }
+
+    if (++s == end) {
+        return -1;
+    }
+
+    switch (*s++) {
+        case '"':
+        case '\\':
+        case '/':
+            cp = (uint8_t) s[-1];
+            break;
+        case 'b':
+            cp = '\b';
+            break;
+        case 'f':
+            cp = '\f';
+            break;
+        case 'n':
+            cp = '\n';
+            break;
+        case 'r':
+            cp = '\r';
+            break;
+        case 't':
+            cp = '\t';
+            break;
+        case 'u':
+            if (!get_hex4(s, end, &cp) || ((0xdc00 <= cp) && (cp <= 0xdfff))) {
+                return -1;
+            }
+            s += 4;
+
+            /* Characters past the first plane are a surrogate pair. */
+            if ((0xd800 <= cp) && (cp <= 0xdbff)) {
+                if (((end - s) < 6) || ('\\' != s[0]) || ('u' != s[1])
+                    || !get_hex4(&s[2], end, &lo) || (lo < 0xdc00) || (0xdfff < lo))
+                {
+                    return -1;
+                }
+                s += 6;
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+            }
+            break;
+        default:
+            return -1;
+    }
+
+    *p = s;
+
+    return put_utf8(buf, cp);
+}
+
+
+/* Reads the string at *p, unescaping it into out when out isn't NULL. */
+static bool get_str(const char **p, const char *end, char *out, size_t *len)
+{
+    char c[4];
+    size_t n = 0;
+    int rv;
+
+    if ((*p == end) || ('"' != **p)) {
+        return false;
+    }
+    (*p)++;
+
+    while (0 < (rv = next_char(p, end, c))) {
+        if (out) {
+            memcpy(&out[n], c, (size_t) rv);
+        }
+        n += (size_t) rv;
+    }
+    *len = n;
+
+    return (0 == rv);
+}
+
+
+static int b64_val(char c)
+{
+    const char *at = strchr(b64, c);
+
+    return (c && at) ? (int) (at - b64) : -1;
+}
+
+
+/* Reads the base64 string at *p, decoding it into out when out isn't NULL.
+ * The padding is optional. */
+static bool get_base64(const char **p, const char *end, uint8_t *out, size_t *len)
+{
+    uint32_t bits   = 0;
+    size_t sextets  = 0;
+    size_t n        = 0;
+    bool pad        = false;
+    char c[4];
+    int rv;
+
+    if ((*p == end) || ('"' != **p)) {
+        return false;
+    }
+    (*p)++;
+
+    while (0 < (rv = next_char(p, end, c))) {
+        int v = (1 == rv) ? b64_val(c[0]) : -1;
+
+        if ((1 == rv) && ('=' == c[0])) {
+            pad = true;
+            continue;
+        }
+        if ((v < 0) || pad) {
+            return false;
+        }
+
+        bits = (bits << 6) | (uint32_t) v;
+        if (0 == (++sextets % 4)) {
+            if (out) {
+                out[n]     = (uint8_t) (bits >> 16);
+                out[n + 1] = (uint8_t) (bits >> 8);
+                out[n + 2] = (uint8_t) bits;
+            }
+            n += 3;
+            bits = 0;
+        }
+    }
+
+    switch (sextets % 4) {
+        case 1:
+            return false;
+        case 2:
+            if (out) {
+                out[n] = (uint8_t) (bits >> 4);
+            }
+            n += 1;
+            break;
+        case 3:
+            if (out) {
+                out[n]     = (uint8_t) (bits >> 10);
+                out[n + 1] = (uint8_t) (bits >> 2);
+            }
+            n += 2;
+            break;
+        default:
+            break;
+    }
+    *len = n;
+
+    return (0 == rv);
+}
+
+
+static bool skip_lit(const char **p, const char *end, const char *lit)
+{
+    size_t len = strlen(lit);
+
+    if (((size_t) (end - *p) < len) || (0 != memcmp(*p, lit, len))) {
+        return false;
+    }
+    *p += len;
+
+    return true;
+}
+
+
+static bool skip_num(const char **p, const char *end)
+{
+    const char *s = *p;
+
+    if ((s < end) && ('-' == *s)) {
+        s++;
+    }
+
+    if ((s < end) && ('0' == *s)) {
+        s++;
+    } else if ((s < end) && is_digit(*s)) {
+        while ((s < end) && is_digit(*s)) {
+            s++;
+        }
+    } else {
+        return false;
+    }
+
+    if ((s < end) && ('.' == *s)) {
+        if ((++s == end) || !is_digit(*s)) {
+            return false;
+        }
+        while ((s < end) && is_digit(*s)) {
+            s++;
+        }
+    }
+
+    if ((s < end) && (('e' == *s) || ('E' == *s))) {
+        s++;
+        if ((s < end) && (('+' == *s) || ('-' == *s))) {
+            s++;
+        }
+        if ((s == end) || !is_digit(*s)) {
+            return false;
+        }
+        while ((s < end) && is_digit(*s)) {
+            s++;
+        }
+    }
+
+    *p = s;
+
+    return true;
+}
+
+
+static bool skip_value(const char **p, const char *end, int depth);
+
+
+static bool skip_items(const char **p, const char *end, int depth)
+{
+    char close = ('{' == **p) ? '}' : ']';
+    size_t len;
+
+    if (MAX_DEPTH < depth) {
+        return false;
+    }
+
+    (*p)++;
+    skip_ws(p, end);
+    if ((*p < end) && (close == **p)) {
+        (*p)++;
+        return true;
+    }
+
+    while (true) {
+        if ('}' == close) {
+            skip_ws(p, end);
+            if (!get_str(p, end, NULL, &len) || !skip_char(p, end, ':')) {
+                return false;
+            }
+        }
+
+        if (!skip_value(p, end, depth)) {
+            return false;
+        }
+
+        skip_ws(p, end);
+        if (*p == end) {
+            return false;
+        }
+        if (close == **p) {
+            (*p)++;
+            return true;
+        }
+        if (',' != **p) {
+            return false;
+        }
+        (*p)++;
+    }
+}
+
+
+/* Checks the value at *p is valid JSON and moves past it. */
+static bool skip_value(const char **p, const char *end, int depth)
+{
+    size_t len;
+
+    skip_ws(p, end);
+    if (*p == end) {
+        return false;
+    }
+
+    switch (**p) {
+        case '"':
+            return get_str(p, end, NULL, &len);
+        case '[':
+        case '{':
+            return skip_items(p, end, depth + 1);
+        case 't':
+            return skip_lit(p, end, "true");
+        case 'f':
+            return skip_lit(p, end, "false");
+        case 'n':
+            return skip_lit(p, end, "null");
+        default:
+            return skip_num(p, end);
+    }
+}
+
+
+/* Checks the text is valid JSON and records where the known values of the
+ * root object are.  Unknown keys are skipped. */
+static WRPcode read_root(const char *p, const char *end, struct values *vals)
+{
+    const char *at = p;
+
+    vals->found = 0;
+
+    if (!skip_value(&at, end, 0)) {
+        return WRPE_NOT_JSON_FORMAT;
+    }
+    skip_ws(&at, end);
+    if (at != end) {
+        return WRPE_NOT_JSON_FORMAT;
+    }
+
+    /* The text is valid, so the walk below only needs to check the types. */
+    if (!skip_char(&p, end, '{')) {
+        return WRPE_NOT_A_WRP_MSG;
+    }
+    skip_ws(&p, end);
+
+    while ('}' != *p) {
+        const struct wrp_token *token = NULL;
+        const char *at                = p;
+        char name[16];
+        size_t len;
+
+        /* None of the keys are long, so longer ones aren't unescaped. */
+        get_str(&p, end, NULL, &len);
+        if (len <= sizeof(name)) {
+            get_str(&at, end, name, &len);
+            token = wrp_token_find(name, len);
+        }
+
+        skip_char(&p, end, ':');
+        skip_ws(&p, end);
+        at = p;
+        skip_value(&p, end, 0);
+
+        if (token) {
+            /* A duplicate key is ambiguous, so reject it. */
+            if (vals->found & WRP_FIELD_BIT(token->id)) {
+                return WRPE_NOT_A_WRP_MSG;
+            }
+            vals->found |= WRP_FIELD_BIT(token->id);
+            vals->v[token->id].start = at;
+            vals->v[token->id].end   = p;
+        }
+
+        skip_ws(&p, end);
+        if (',' == *p) {
+            p++;
+            skip_ws(&p, end);
+        }
+    }
+
+    return WRPE_OK;
+}
+
+
+static bool get_value(struct slab *s, struct values *vals, int flags,
+                      const struct wrp_token *token, struct value **v)
+{
+    if (vals->found & WRP_FIELD_BIT(token->id)) {
+        *v = &vals->v[token->id];
+        if ('n' != *(*v)->start) {
+            return true;
+        }
+    }
+
+    /* Missing and null are the same, and neither will do if it's required. */
+    if (REQUIRED == flags) {
+        s->rv = WRPE_NOT_A_WRP_MSG;
+    }
+
+    return false;
+}
+
+
+static bool get_int(const struct value *v, int *i)
+{
+    const char *p = v->start;
+    bool neg      = false;
+    long long n   = 0;
+
+    if ((p < v->end) && ('-' == *p)) {
+        neg = true;
+        p++;
+    }
+    if (p == v->end) {
+        return false;
+    }
+
+    for (; p < v->end; p++) {
+        if (!is_digit(*p)) {
+            return false;
+        }
+        n = (n * 10) + (*p - '0');
+        if (((long long) INT_MAX + 1) < n) {
+            return false;
+        }
+    }
+
+    n = neg ? -n : n;
+    if (INT_MAX < n) {
+        return false;
+    }
+    *i = (int) n;
+
+    return true;
+}
+
+
+/* Accounts for the len bytes just written at the next free spot in the slab. */
+static const void *used(struct slab *s, size_t len)
+{
+    const void *rv = NULL;
+
+    if (!s->place) {
+        s->bytes += len;
+        return NULL;
+    }
+
+    if (len) {
+        rv = s->next;
+        s->next += len;
+    }
+
+    return rv;
+}
+
+
+static bool js_string(struct slab *s, const char **p, const char *end,
+                      struct wrp_string *str)
+{
+    size_t len;
+
+    skip_ws(p, end);
+    if (!get_str(p, end, s->place ? s->next : NULL, &len)) {
+        s->rv = WRPE_NOT_A_WRP_MSG;
+        return false;
+    }
+
+    str->s   = (const char *) used(s, len);
+    str->len = len;
+
+    return true;
+}
+
+
+static void js_mtype(struct slab *s, struct values *vals, enum wrp_msg_type *t)
+{
+    struct value *v;
+    int type;
+
+    if (!get_value(s, vals, REQUIRED, &WRP_MSG_TYPE, &v) || !get_int(v, &type)
+        || (type < 0) || (UINT8_MAX < type))
+    {
+        s->rv = WRPE_NOT_A_WRP_MSG;
+        return;
+    }
+
+    *t = (enum wrp_msg_type) type;
+}
+
+
+static void js_str__(struct slab *s, struct values *vals, int flags,
+                     const struct wrp_token *token, struct wrp_string *str)
+{
+    struct value *v;
+    const char *p;
+
+    if (get_value(s, vals, flags, token, &v)) {
+        p = v->start;
+        js_string(s, &p, v->end, str);
+    }
+}
+
+
+static void js_int__(struct slab *s, struct values *vals, int flags,
+                     const struct wrp_token *token, struct wrp_int *i)
+{
+    struct value *v;
+
+    i->num             = NULL;
+    i->__internal_only = 0;
+    if (get_value(s, vals, flags, token, &v)) {
+        if (get_int(v, &i->__internal_only)) {
+            i->num = &i->__internal_only;
+        } else {
+            s->rv = WRPE_NOT_A_WRP_MSG;
+        }
+    }
+}
+
+
+static void js_blob_(struct slab *s, struct values *vals, const struct wrp_token *token,
+                     struct wrp_blob *blob)
+{
+    struct value *v;
+    const char *p;
+    size_t len;
+    bool ok;
+
+    if ((WRP_JSON_PAYLOAD__OMIT == s->payload) || !get_value(s, vals, OPTIONAL, token, &v)) {
+        return;
+    }
+
+    p = v->start;
+    if (WRP_JSON_PAYLOAD__BASE64 == s->payload) {
+        ok = get_base64(&p, v->end, s->place ? (uint8_t *) s->next : NULL, &len);
+    } else {
+        ok = get_str(&p, v->end, s->place ? s->next : NULL, &len);
+    }
+
+    if (!ok) {
+        s->rv = WRPE_NOT_A_WRP_MSG;
+        return;
+    }
+
+    blob->data = (const uint8_t *) used(s, len);
+    blob->len  = len;
+}
+
+
+static void js_slist(struct slab *s, struct values *vals, const struct wrp_token *token,
+                     struct wrp_string_list *l)
+{
+    struct value *v;
+    const char *p;
+
+    l->list  = NULL;
+    l->count = 0;
+    if (!get_value(s, vals, OPTIONAL, token, &v)) {
+        return;
+    }
+
+    if ('[' != *v->start) {
+        s->rv = WRPE_NOT_A_WRP_MSG;
+        return;
+    }
+
+    if (s->place) {
+        l->list = s->mem.strings;
+    }
+
+    p = &v->start[1];
+    skip_ws(&p, v->end);
+    while (']' != *p) {
+        struct wrp_string str = { 0, NULL };
+
+        if (!js_string(s, &p, v->end, &str)) {
+            return;
+        }
+
+        if (s->place) {
+            s->mem.strings[0] = str;
+            s->mem.strings++;
+        } else {
+            s->strings++;
+        }
+        l->count++;
+
+        skip_ws(&p, v->end);
+        if (',' == *p) {
+            p++;
+            skip_ws(&p, v->end);
+        }
+    }
+
+    if (!l->count) {
+        l->list = NULL;
+    }
+}
+
+
+static void js_nvpl_(struct slab *s, struct values *vals, const struct wrp_token *token,
+                     struct wrp_nvp_list *l)
+{
+    struct value *v;
+    const char *p;
+
+    l->list  = NULL;
+    l->count = 0;
+    if (!get_value(s, vals, OPTIONAL, token, &v)) {
+        return;
+    }
+
+    if ('{' != *v->start) {
+        s->rv = WRPE_NOT_A_WRP_MSG;
+        return;
+    }
+
+    if (s->place) {
+        l->list = s->mem.nvps;
+    }
+
+    p = &v->start[1];
+    skip_ws(&p, v->end);
+    while ('}' != *p) {
+        struct wrp_nvp nvp = { { 0, NULL }, { 0, NULL } };
+
+        if (!js_string(s, &p, v->end, &nvp.name)) {
+            return;
+        }
+        skip_char(&p, v->end, ':');
+        skip_ws(&p, v->end);
+
+        /* A null value is the same as an empty one. */
+        if (!skip_lit(&p, v->end, "null") && !js_string(s, &p, v->end, &nvp.value)) {
+            return;
+        }
+
+        if (s->place) {
+            s->mem.nvps[0] = nvp;
+            s->mem.nvps++;
+        } else {
+            s->nvps++;
+        }
+        l->count++;
+
+        skip_ws(&p, v->end);
+        if (',' == *p) {
+            p++;
+            skip_ws(&p, v->end);
+        }
+    }
+
+    if (!l->count) {
+        l->list = NULL;
+    }
+}
+
+
+static void js_msg(struct slab *s, struct values *vals, wrp_msg_t *msg)
+{
+    js_mtype(s, vals, &msg->msg_type);
+    if (WRPE_OK != s->rv) {
+        return;
+    }
+
+    switch (msg->msg_type) {
+        case WRP_MSG_TYPE__AUTH:
+            js_int__(s, vals, REQUIRED, &WRP_STATUS__, &msg->u.auth.status);
+            break;
+
+        case WRP_MSG_TYPE__REQ:
+            js_str__(s, vals, REQUIRED, &WRP_SOURCE__, &msg->u.req.source);
+            js_str__(s, vals, REQUIRED, &WRP_DEST____, &msg->u.req.dest);
+            js_str__(s, vals, REQUIRED, &WRP_TRANS_ID, &msg->u.req.trans_id);
+            js_str__(s, vals, OPTIONAL, &WRP_CT______, &msg->u.req.content_type);
+            js_str__(s, vals, OPTIONAL, &WRP_ACCEPT__, &msg->u.req.accept);
+            js_int__(s, vals, OPTIONAL, &WRP_RDR_____, &msg->u.req.rdr);
+            js_int__(s, vals, OPTIONAL, &WRP_STATUS__, &msg->u.req.status);
+            js_blob_(s, vals, &WRP_PAYLOAD_, &msg->u.req.payload);
+            js_slist(s, vals, &WRP_PARTNERS, &msg->u.req.partner_ids);
+            js_nvpl_(s, vals, &WRP_METADATA, &msg->u.req.metadata);
+            js_slist(s, vals, &WRP_HEADERS_, &msg->u.req.headers);
+            js_str__(s, vals, OPTIONAL, &WRP_MSG_ID__, &msg->u.req.msg_id);
+            js_str__(s, vals, OPTIONAL, &WRP_SESS_ID_, &msg->u.req.session_id);
+            break;
+
+        case WRP_MSG_TYPE__EVENT:
+            js_str__(s, vals, REQUIRED, &WRP_SOURCE__, &msg->u.event.source);
+            js_str__(s, vals, REQUIRED, &WRP_DEST____, &msg->u.event.dest);
+            js_str__(s, vals, OPTIONAL, &WRP_CT______, &msg->u.event.content_type);
+            js_blob_(s, vals, &WRP_PAYLOAD_, &msg->u.event.payload);
+            js_slist(s, vals, &WRP_PARTNERS, &msg->u.event.partner_ids);
+            js_nvpl_(s, vals, &WRP_METADATA, &msg->u.event.metadata);
+            js_slist(s, vals, &WRP_HEADERS_, &msg->u.event.headers);
+            js_str__(s, vals, OPTIONAL, &WRP_MSG_ID__, &msg->u.event.msg_id);
+            js_str__(s, vals, OPTIONAL, &WRP_SESS_ID_, &msg->u.event.session_id);
+            break;
+
+        case WRP_MSG_TYPE__CREATE:
+        case WRP_MSG_TYPE__RETRIEVE:
+        case WRP_MSG_TYPE__UPDATE:
+        case WRP_MSG_TYPE__DELETE:
+            js_str__(s, vals, REQUIRED, &WRP_SOURCE__, &msg->u.crud.source);
+            js_str__(s, vals, REQUIRED, &WRP_DEST____, &msg->u.crud.dest);
+            js_str__(s, vals, REQUIRED, &WRP_TRANS_ID, &msg->u.crud.trans_id);
+            js_str__(s, vals, OPTIONAL, &WRP_CT______, &msg->u.crud.content_type);
+            js_str__(s, vals, OPTIONAL, &WRP_ACCEPT__, &msg->u.crud.accept);
+            js_str__(s, vals, OPTIONAL, &WRP_PATH____, &msg->u.crud.path);
+            js_int__(s, vals, OPTIONAL, &WRP_RDR_____, &msg->u.crud.rdr);
+            js_int__(s, vals, OPTIONAL, &WRP_STATUS__, &msg->u.crud.status);
+            js_blob_(s, vals, &WRP_PAYLOAD_, &msg->u.crud.payload);
+            js_slist(s, vals, &WRP_PARTNERS, &msg->u.crud.partner_ids);
+            js_nvpl_(s, vals, &WRP_METADATA, &msg->u.crud.metadata);
+            js_slist(s, vals, &WRP_HEADERS_, &msg->u.crud.headers);
+            js_str__(s, vals, OPTIONAL, &WRP_MSG_ID__, &msg->u.crud.msg_id);
+            js_str__(s, vals, OPTIONAL, &WRP_SESS_ID_, &msg->u.crud.session_id);
+            break;
+
+        case WRP_MSG_TYPE__SVC_REG:
+            js_str__(s, vals, REQUIRED, &WRP_SN______, &msg->u.reg.service_name);
+            js_str__(s, vals, REQUIRED, &WRP_URL_____, &msg->u.reg.url);
+            break;
+
+        case WRP_MSG_TYPE__SVC_ALIVE:
+            break;
+
+        default:
+            s->rv = WRPE_NOT_A_WRP_MSG;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+WRPcode wrp_to_json(const wrp_msg_t *msg, enum wrp_json_payload payload, char *buf,
+                    size_t size, size_t *len)
+{
+    struct out o;
+    WRPcode rv;
+
+    if (!msg || (!buf && size) || (WRP_JSON_PAYLOAD__UTF8 < payload)) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    memset(&o, 0, sizeof(o));
+    o.buf     = buf;
+    o.size    = size;
+    o.payload = payload;
+
+    rv = json_msg(&o, msg);
+
+    if (size) {
+        buf[(o.len < size) ? o.len : (size - 1)] = '\0';
+    }
+    if (len) {
+        *len = o.len;
+    }
+
+    if ((WRPE_OK == rv) && (size <= o.len)) {
+        rv = WRPE_MSG_TOO_BIG;
+    }
+
+    return rv;
+}
+
+
+WRPcode wrp_to_json_flush(const wrp_msg_t *msg, enum wrp_json_payload payload,
+                          void *buf, size_t size, wrp_flush_fn fn, void *ctx)
+{
+    struct out o;
+    WRPcode rv;
+
+    if (!msg || !buf || (size < MIN_STAGING) || !fn || (WRP_JSON_PAYLOAD__UTF8 < payload)) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    memset(&o, 0, sizeof(o));
+    o.buf     = (char *) buf;
+    o.size    = size;
+    o.fn      = fn;
+    o.ctx     = ctx;
+    o.rv      = WRPE_OK;
+    o.payload = payload;
+
+    rv = json_msg(&o, msg);
+    if (WRPE_OK != rv) {
+        return rv;
+    }
+
+    flush(&o, o.buf, o.used);
+
+    return o.rv;
+}
+
+
+WRPcode wrp_from_json(const char *src, size_t len, enum wrp_json_payload payload,
+                      wrp_msg_t **dest)
+{
+    struct wrp_internal *p = NULL;
+    struct values vals;
+    struct slab s;
+    wrp_msg_t tmp;
+    size_t size;
+    WRPcode rv;
+
+    if (!src || !dest || (WRP_JSON_PAYLOAD__UTF8 < payload)) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    rv = read_root(src, &src[len], &vals);
+    if (WRPE_OK != rv) {
+        return rv;
+    }
+
+    /* Pass 1: size everything using a throw away message. */
+    memset(&s, 0, sizeof(s));
+    memset(&tmp, 0, sizeof(tmp));
+    s.rv      = WRPE_OK;
+    s.payload = payload;
+    js_msg(&s, &vals, &tmp);
+    if (WRPE_OK != s.rv) {
+        return s.rv;
+    }
+
+    size = sizeof(struct wrp_internal)
+         + (s.strings * sizeof(struct wrp_string))
+         + (s.nvps * sizeof(struct wrp_nvp))
+         + s.bytes;
+
+    p = calloc(1, size);
+    if (!p) {
+        return WRPE_OUT_OF_MEMORY;
+    }
+
+    p->sig                 = INTERNAL_SIGNATURE;
+    p->msg.__internal_only = (void *) p;
+
+    /* Pass 2: unescape everything in place. */
+    s.place       = true;
+    s.mem.strings = (struct wrp_string *) &p[1];
+    s.mem.nvps    = (struct wrp_nvp *) &s.mem.strings[s.strings];
+    s.next        = (char *) &s.mem.nvps[s.nvps];
+    js_msg(&s, &vals, &p->msg);
+
+    *dest = &p->msg;
+
+    return WRPE_OK;
+}
@@ -0,0 +1,129 @@
+/* SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "wrp-c.h"
+
+/*----------------------------------------------------------------------------*/
+/*                                   Macros                                   */
+/*----------------------------------------------------------------------------*/
+#define INITIAL_SIZE 1024
+
+/*----------------------------------------------------------------------------*/
+/*                               Data Structures                              */
+/*----------------------------------------------------------------------------*/
+
+/* The formatting buffer each thread reuses. */
+struct tls_buf {
+    char *buf;
+    size_t size;
+};
+
+/*----------------------------------------------------------------------------*/
+/*                            File Scoped Variables                           */
+/*----------------------------------------------------------------------------*/
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static bool key_ok = false;
+
+/*----------------------------------------------------------------------------*/
+/*                             Internal functions                             */
+/*----------------------------------------------------------------------------*/
+static void release(void *p)
+{
+    struct tls_buf *tb = (struct tls_buf *) p;
+
+    free(tb->buf);
+    free(tb);
+}
+
+
+static void make_key(void)
+{
+    key_ok = (0 == pthread_key_create(&key, release));
+}
+
+
+/* Returns this thread's buffer with room for at least size bytes. */
+static struct tls_buf *get_buf(size_t size)
+{
+    struct tls_buf *tb;
+    char *buf;
+
+    pthread_once(&once, make_key);
+    if (!key_ok) {
+        return NULL;
+    }
+
+    tb = (struct tls_buf *) pthread_getspecific(key);
+    if (!tb) {
+        tb = calloc(1, sizeof(struct tls_buf));
+        if (!tb || (0 != pthread_setspecific(key, tb))) {
+            free(tb);
+            return NULL;
+        }
+    }
+
+    if (tb->size < size) {
+        buf = realloc(tb->buf, size);
+        if (!buf) {
+            return NULL;
+        }
+        tb->buf  = buf;
+        tb->size = size;
+    }
+
+    return tb;
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+bool wrp_log_enabled(const struct wrp_log *log, enum wrp_log_level level)
+{
+    return log && log->fn && (level <= log->level);
+}
+
+
+WRPcode wrp_log_msg(const struct wrp_log *log, enum wrp_log_level level,
+                    const wrp_msg_t *msg)
+{
+    struct tls_buf *tb;
+    size_t len;
+    WRPcode rv;
+
+    if (!msg) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    /* Nothing is formatted unless the message will be logged. */
+    if (!wrp_log_enabled(log, level)
+        || (log->filter && !log->filter(log->ctx, level, msg)))
+    {
+        return WRPE_OK;
+    }
+
+    tb = get_buf(INITIAL_SIZE);
+    if (!tb) {
+        return WRPE_OUT_OF_MEMORY;
+    }
+
+    rv = wrp_to_string_buf(msg, tb->buf, tb->size, &len);
+    if (WRPE_MSG_TOO_BIG == rv) {
+        tb = get_buf(len + 1);
+        if (!tb) {
+            return WRPE_OUT_OF_MEMORY;
+        }
+        rv = wrp_to_string_buf(msg, tb->buf, tb->size, &len);
+    }
+
+    if (WRPE_OK == rv) {
+        log->fn(log->ctx, level, tb->buf, len);
+    }
+
+    return rv;
+}
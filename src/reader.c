@@ -0,0 +1,667 @@
+/* SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "internal.h"
+#include "wrp-c.h"
+
+/*----------------------------------------------------------------------------*/
+/*                                   Macros                                   */
+/*----------------------------------------------------------------------------*/
+/* none */
+
+/*----------------------------------------------------------------------------*/
+/*                               Data Structures                              */
+/*----------------------------------------------------------------------------*/
+
+/* A value from the root map.  Strings and blobs point at their bytes, arrays
+ * and maps point at their first element and are only walked once the storage
+ * for them exists. */
+struct value {
+    mpack_tag_t tag;
+    const char *data;
+    const char *end;
+};
+
+/* Where the next value starts and where the map or array holding it ends. */
+struct cursor {
+    const char *p;
+    const char *end;
+};
+
+struct values {
+    mpack_reader_t *r;
+    uint32_t found;
+    uint32_t dups;
+    struct value v[WRP_FIELD__LAST];
+};
+
+/*----------------------------------------------------------------------------*/
+/*                            File Scoped Variables                           */
+/*----------------------------------------------------------------------------*/
+/* none */
+
+/*----------------------------------------------------------------------------*/
+/*                             Function Prototypes                            */
+/*----------------------------------------------------------------------------*/
+/* none */
+
+/*----------------------------------------------------------------------------*/
+/*                             Internal functions                             */
+/*----------------------------------------------------------------------------*/
+static void end_reader(struct values *vals, mpack_reader_t *r)
+{
+    mpack_error_t err = mpack_reader_destroy(r);
+
+    if (mpack_ok != err) {
+        mpack_reader_flag_error(vals->r, err);
+    }
+}
+
+
+/* Reads the value at c->p and moves past it.  The end is found with
+ * frame_scan() and only the tag is read, so skipping a value never recurses
+ * however deeply it nests, and the reader never has a compound open. */
+static bool read_value(struct values *vals, struct cursor *c, struct value *v)
+{
+    struct frame_scanner sc = { 0, 0 };
+    mpack_reader_t r;
+    size_t used;
+
+    if (mpack_ok != mpack_reader_error(vals->r)) {
+        return false;
+    }
+
+    if (FRAME__DONE
+        != frame_scan(&sc, (const uint8_t *) c->p, (size_t) (c->end - c->p), &used))
+    {
+        mpack_reader_flag_error(vals->r, mpack_error_invalid);
+        return false;
+    }
+
+    mpack_reader_init_data(&r, c->p, used);
+    v->tag = mpack_peek_tag(&r);
+    end_reader(vals, &r);
+
+    v->end = c->p + used;
+
+    /* The bytes of a string or blob end the value, so an empty one points
+     * just past its header like the tree decoder's do. */
+    switch (mpack_tag_type(&v->tag)) {
+        case mpack_type_str:
+            v->data = v->end - mpack_tag_str_length(&v->tag);
+            break;
+
+        case mpack_type_bin:
+            v->data = v->end - mpack_tag_bin_length(&v->tag);
+            break;
+
+        case mpack_type_array:
+        case mpack_type_map:
+            /* The count follows the first byte unless it is a fix format. */
+            switch ((uint8_t) *c->p) {
+                case 0xdc: /* array 16 */
+                case 0xde: /* map 16   */
+                    v->data = c->p + 3;
+                    break;
+                case 0xdd: /* array 32 */
+                case 0xdf: /* map 32   */
+                    v->data = c->p + 5;
+                    break;
+                default:
+                    v->data = c->p + 1;
+                    break;
+            }
+            break;
+
+        default:
+            v->data = NULL;
+            break;
+    }
+
+    c->p = v->end;
+
+    return (mpack_ok == mpack_reader_error(vals->r));
+}
+
+
+/* Only the wanted values are recorded, the rest are skipped over. */
+static void read_root(mpack_reader_t *r, uint32_t wanted, struct values *vals)
+{
+    struct value root;
+    struct cursor c;
+    uint32_t count;
+    size_t len;
+
+    vals->r     = r;
+    vals->found = 0;
+    vals->dups  = 0;
+
+    /* The reader is only used for its error, the root is walked by hand. */
+    len   = mpack_reader_remaining(r, &c.p);
+    c.end = c.p + len;
+    if (!read_value(vals, &c, &root)) {
+        return;
+    }
+
+    if (mpack_type_map != mpack_tag_type(&root.tag)) {
+        mpack_reader_flag_error(r, mpack_error_type);
+        return;
+    }
+
+    c.p   = root.data;
+    c.end = root.end;
+
+    count = mpack_tag_map_count(&root.tag);
+    for (uint32_t i = 0; i < count; i++) {
+        const struct wrp_token *token = NULL;
+        struct value key;
+        struct value val;
+        uint32_t bit;
+
+        if (!read_value(vals, &c, &key) || !read_value(vals, &c, &val)) {
+            return;
+        }
+
+        if (mpack_type_str == mpack_tag_type(&key.tag)) {
+            token = wrp_token_find(key.data, mpack_tag_str_length(&key.tag));
+        }
+
+        if (!token || !(wanted & (1u << token->id))) {
+            continue;
+        }
+
+        /* A duplicate key is only rejected if the message type uses it. */
+        bit = 1u << token->id;
+        if ((vals->found | vals->dups) & bit) {
+            vals->found &= ~bit;
+            vals->dups  |= bit;
+            continue;
+        }
+
+        vals->found |= bit;
+        vals->v[token->id] = val;
+    }
+}
+
+
+static bool get_value(struct values *vals, int flags, const struct wrp_token *token,
+                      struct value **v)
+{
+    /* A duplicate key is ambiguous, so reject it. */
+    if (vals->dups & (1u << token->id)) {
+        mpack_reader_flag_error(vals->r, mpack_error_data);
+        return false;
+    }
+
+    if (vals->found & (1u << token->id)) {
+        *v = &vals->v[token->id];
+        return (mpack_type_nil != mpack_tag_type(&(*v)->tag));
+    }
+
+    if (REQUIRED == flags) {
+        mpack_reader_flag_error(vals->r, mpack_error_data);
+    }
+
+    return false;
+}
+
+
+static bool is_type(struct values *vals, struct value *v, mpack_type_t type)
+{
+    if (type != mpack_tag_type(&v->tag)) {
+        mpack_reader_flag_error(vals->r, mpack_error_type);
+        return false;
+    }
+
+    return true;
+}
+
+
+static bool to_int(mpack_tag_t *tag, int *i)
+{
+    if (mpack_type_uint == mpack_tag_type(tag)) {
+        if (mpack_tag_uint_value(tag) <= INT_MAX) {
+            *i = (int) mpack_tag_uint_value(tag);
+            return true;
+        }
+    } else if (mpack_type_int == mpack_tag_type(tag)) {
+        if ((INT_MIN <= mpack_tag_int_value(tag)) && (mpack_tag_int_value(tag) <= INT_MAX)) {
+            *i = (int) mpack_tag_int_value(tag);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+static void get_msg_type(struct values *vals, enum wrp_msg_type *t)
+{
+    struct value *v;
+    int type;
+
+    if (!get_value(vals, REQUIRED, &WRP_MSG_TYPE, &v)
+        || !to_int(&v->tag, &type) || (type < 0) || (UINT8_MAX < type))
+    {
+        mpack_reader_flag_error(vals->r, mpack_error_data);
+        return;
+    }
+
+    *t = (enum wrp_msg_type) type;
+}
+
+
+static size_t count_of(struct values *vals, const struct wrp_token *token, mpack_type_t type)
+{
+    struct value *v = &vals->v[token->id];
+
+    if (!(vals->found & (1u << token->id)) || (type != mpack_tag_type(&v->tag))) {
+        return 0;
+    }
+
+    if (mpack_type_map == type) {
+        return mpack_tag_map_count(&v->tag);
+    }
+
+    return mpack_tag_array_count(&v->tag);
+}
+
+
+static void rd_str__(struct values *vals, int flags, const struct wrp_token *token,
+                     struct wrp_string *s)
+{
+    struct value *v;
+
+    if (get_value(vals, flags, token, &v) && is_type(vals, v, mpack_type_str)) {
+        s->s   = v->data;
+        s->len = mpack_tag_str_length(&v->tag);
+    }
+}
+
+
+static void rd_int__(struct values *vals, int flags, const struct wrp_token *token,
+                     struct wrp_int *i)
+{
+    struct value *v;
+
+    i->num             = NULL;
+    i->__internal_only = 0;
+    if (get_value(vals, flags, token, &v)) {
+        if (to_int(&v->tag, &i->__internal_only)) {
+            i->num = &i->__internal_only;
+        } else {
+            mpack_reader_flag_error(vals->r, mpack_error_type);
+        }
+    }
+}
+
+
+static void rd_blob_(struct values *vals, int flags, const struct wrp_token *token,
+                     struct wrp_blob *blob)
+{
+    struct value *v;
+
+    if (get_value(vals, flags, token, &v) && is_type(vals, v, mpack_type_bin)) {
+        blob->data = (const uint8_t *) v->data;
+        blob->len  = mpack_tag_bin_length(&v->tag);
+    }
+}
+
+
+static bool rd_string(struct values *vals, struct cursor *c, struct wrp_string *s)
+{
+    struct value v;
+
+    if (!read_value(vals, c, &v) || !is_type(vals, &v, mpack_type_str)) {
+        return false;
+    }
+
+    s->s   = v.data;
+    s->len = mpack_tag_str_length(&v.tag);
+
+    return true;
+}
+
+
+static void rd_slist(struct values *vals, int flags, const struct wrp_token *token,
+                     struct wrp_string_list *l, struct wrp_lists *mem)
+{
+    struct value *v;
+    struct cursor c;
+
+    if (!get_value(vals, flags, token, &v) || !is_type(vals, v, mpack_type_array)) {
+        return;
+    }
+
+    l->count = mpack_tag_array_count(&v->tag);
+    if (l->count) {
+        l->list = mem->strings;
+        mem->strings += l->count;
+
+        c.p   = v->data;
+        c.end = v->end;
+        for (size_t i = 0; i < l->count; i++) {
+            if (!rd_string(vals, &c, &l->list[i])) {
+                return;
+            }
+        }
+    }
+}
+
+
+static void rd_nvpl_(struct values *vals, int flags, const struct wrp_token *token,
+                     struct wrp_nvp_list *l, struct wrp_lists *mem)
+{
+    struct value *v;
+    struct value val;
+    struct cursor c;
+
+    if (!get_value(vals, flags, token, &v) || !is_type(vals, v, mpack_type_map)) {
+        return;
+    }
+
+    l->count = mpack_tag_map_count(&v->tag);
+    if (l->count) {
+        l->list = mem->nvps;
+        mem->nvps += l->count;
+
+        c.p   = v->data;
+        c.end = v->end;
+        for (size_t i = 0; i < l->count; i++) {
+            if (!rd_string(vals, &c, &l->list[i].name)) {
+                return;
+            }
+
+            if (!read_value(vals, &c, &val)) {
+                return;
+            }
+
+            /* A nil or empty value is left NULL, as the tree decoder does. */
+            if ((mpack_type_nil != mpack_tag_type(&val.tag))
+                && is_type(vals, &val, mpack_type_str))
+            {
+                l->list[i].value.len = mpack_tag_str_length(&val.tag);
+                if (l->list[i].value.len) {
+                    l->list[i].value.s = val.data;
+                }
+            }
+        }
+    }
+}
+
+
+static void decode_values(struct values *vals, wrp_msg_t *msg, struct wrp_lists *mem)
+{
+    switch (msg->msg_type) {
+        case WRP_MSG_TYPE__AUTH:
+            rd_int__(vals, REQUIRED, &WRP_STATUS__, &msg->u.auth.status);
+            break;
+
+        case WRP_MSG_TYPE__REQ:
+            rd_str__(vals, REQUIRED, &WRP_SOURCE__, &msg->u.req.source);
+            rd_str__(vals, REQUIRED, &WRP_DEST____, &msg->u.req.dest);
+            rd_str__(vals, REQUIRED, &WRP_TRANS_ID, &msg->u.req.trans_id);
+            rd_str__(vals, OPTIONAL, &WRP_CT______, &msg->u.req.content_type);
+            rd_str__(vals, OPTIONAL, &WRP_ACCEPT__, &msg->u.req.accept);
+            rd_int__(vals, OPTIONAL, &WRP_RDR_____, &msg->u.req.rdr);
+            rd_int__(vals, OPTIONAL, &WRP_STATUS__, &msg->u.req.status);
+            rd_blob_(vals, OPTIONAL, &WRP_PAYLOAD_, &msg->u.req.payload);
+            rd_slist(vals, OPTIONAL, &WRP_PARTNERS, &msg->u.req.partner_ids, mem);
+            rd_nvpl_(vals, OPTIONAL, &WRP_METADATA, &msg->u.req.metadata, mem);
+            rd_slist(vals, OPTIONAL, &WRP_HEADERS_, &msg->u.req.headers, mem);
+            rd_str__(vals, OPTIONAL, &WRP_MSG_ID__, &msg->u.req.msg_id);
+            rd_str__(vals, OPTIONAL, &WRP_SESS_ID_, &msg->u.req.session_id);
+            break;
+
+        case WRP_MSG_TYPE__EVENT:
+            rd_str__(vals, REQUIRED, &WRP_SOURCE__, &msg->u.event.source);
+            rd_str__(vals, REQUIRED, &WRP_DEST____, &msg->u.event.dest);
+            rd_str__(vals, OPTIONAL, &WRP_CT______, &msg->u.event.content_type);
+            rd_blob_(vals, OPTIONAL, &WRP_PAYLOAD_, &msg->u.event.payload);
+            rd_slist(vals, OPTIONAL, &WRP_PARTNERS, &msg->u.event.partner_ids, mem);
+            rd_nvpl_(vals, OPTIONAL, &WRP_METADATA, &msg->u.event.metadata, mem);
+            rd_slist(vals, OPTIONAL, &WRP_HEADERS_, &msg->u.event.headers, mem);
+            rd_str__(vals, OPTIONAL, &WRP_MSG_ID__, &msg->u.event.msg_id);
+            rd_str__(vals, OPTIONAL, &WRP_SESS_ID_, &msg->u.event.session_id);
+            break;
+
+        case WRP_MSG_TYPE__CREATE:
+        case WRP_MSG_TYPE__RETRIEVE:
+        case WRP_MSG_TYPE__UPDATE:
+        case WRP_MSG_TYPE__DELETE:
+            rd_str__(vals, REQUIRED, &WRP_SOURCE__, &msg->u.crud.source);
+            rd_str__(vals, REQUIRED, &WRP_DEST____, &msg->u.crud.dest);
+            rd_str__(vals, REQUIRED, &WRP_TRANS_ID, &msg->u.crud.trans_id);
+            rd_str__(vals, OPTIONAL, &WRP_CT______, &msg->u.crud.content_type);
+            rd_str__(vals, OPTIONAL, &WRP_ACCEPT__, &msg->u.crud.accept);
+            rd_str__(vals, OPTIONAL, &WRP_PATH____, &msg->u.crud.path);
+            rd_int__(vals, OPTIONAL, &WRP_RDR_____, &msg->u.crud.rdr);
+            rd_int__(vals, OPTIONAL, &WRP_STATUS__, &msg->u.crud.status);
+            rd_blob_(vals, OPTIONAL, &WRP_PAYLOAD_, &msg->u.crud.payload);
+            rd_slist(vals, OPTIONAL, &WRP_PARTNERS, &msg->u.crud.partner_ids, mem);
+            rd_nvpl_(vals, OPTIONAL, &WRP_METADATA, &msg->u.crud.metadata, mem);
+            rd_slist(vals, OPTIONAL, &WRP_HEADERS_, &msg->u.crud.headers, mem);
+            rd_str__(vals, OPTIONAL, &WRP_MSG_ID__, &msg->u.crud.msg_id);
+            rd_str__(vals, OPTIONAL, &WRP_SESS_ID_, &msg->u.crud.session_id);
+            break;
+
+        case WRP_MSG_TYPE__SVC_REG:
+            rd_str__(vals, REQUIRED, &WRP_SN______, &msg->u.reg.service_name);
+            rd_str__(vals, REQUIRED, &WRP_URL_____, &msg->u.reg.url);
+            break;
+
+        case WRP_MSG_TYPE__SVC_ALIVE:
+            break;
+
+        default:
+            mpack_reader_flag_error(vals->r, mpack_error_data);
+    }
+}
+
+
+/* Reads the root map and works out the size of the storage needed for the
+ * message and its lists. */
+static size_t read_msg(mpack_reader_t *r, const void *data, size_t len,
+                       struct values *vals, enum wrp_msg_type *type, size_t *strings)
+{
+    size_t nvps = 0;
+
+    *type    = 0;
+    *strings = 0;
+
+    mpack_reader_init_data(r, (const char *) data, len);
+    read_root(r, WRP_FIELDS_ALL, vals);
+    get_msg_type(vals, type);
+
+    /* Only the message types with lists need the extra space, and only
+     * for the lists that are well formed. */
+    if (has_lists(*type)) {
+        *strings = count_of(vals, &WRP_PARTNERS, mpack_type_array)
+                 + count_of(vals, &WRP_HEADERS_, mpack_type_array);
+        nvps = count_of(vals, &WRP_METADATA, mpack_type_map);
+    }
+
+    return sizeof(struct wrp_internal)
+         + (*strings * sizeof(struct wrp_string))
+         + (nvps * sizeof(struct wrp_nvp));
+}
+
+
+/* Decodes the values into the zeroed storage sized by read_msg(). */
+static void place_msg(struct values *vals, enum wrp_msg_type type, size_t strings,
+                      bool external, struct wrp_internal *p)
+{
+    struct wrp_lists mem;
+
+    p->sig                 = INTERNAL_SIGNATURE;
+    p->external            = external;
+    p->msg.__internal_only = (void *) p;
+    p->msg.msg_type        = type;
+
+    mem.strings = (struct wrp_string *) &p[1];
+    mem.nvps    = (struct wrp_nvp *) &mem.strings[strings];
+
+    decode_values(vals, &p->msg, &mem);
+}
+
+
+static WRPcode decode(const void *data, size_t len, void *arena, size_t arena_len,
+                      wrp_msg_t **msg)
+{
+    struct wrp_internal *p = NULL;
+    struct values vals;
+    mpack_reader_t r;
+    enum wrp_msg_type type;
+    size_t strings;
+    size_t size;
+    WRPcode rv;
+
+    size = read_msg(&r, data, len, &vals, &type, &strings);
+
+    if (mpack_ok == mpack_reader_error(&r)) {
+        if (arena) {
+            p = arena_take(arena, arena_len, size);
+            if (!p) {
+                mpack_reader_flag_error(&r, mpack_error_too_big);
+            }
+        } else {
+            p = calloc(1, size);
+            if (!p) {
+                mpack_reader_flag_error(&r, mpack_error_memory);
+            }
+        }
+    }
+
+    if (p) {
+        place_msg(&vals, type, strings, (NULL != arena), p);
+    }
+
+    rv = map_mpack_err(mpack_reader_destroy(&r));
+    if (WRPE_OK != rv) {
+        if (!arena) {
+            free(p);
+        }
+    } else {
+        *msg = &p->msg;
+    }
+
+    return rv;
+}
+
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+size_t reader_msg_size(const void *data, size_t len, WRPcode *rv)
+{
+    struct values vals;
+    mpack_reader_t r;
+    enum wrp_msg_type type;
+    size_t strings;
+    size_t size;
+
+    size = read_msg(&r, data, len, &vals, &type, &strings);
+    *rv  = map_mpack_err(mpack_reader_destroy(&r));
+
+    return (WRPE_OK == *rv) ? size : 0;
+}
+
+
+WRPcode reader_place_msg(const void *data, size_t len, struct wrp_internal *p)
+{
+    struct values vals;
+    mpack_reader_t r;
+    enum wrp_msg_type type;
+    size_t strings;
+
+    read_msg(&r, data, len, &vals, &type, &strings);
+    if (mpack_ok == mpack_reader_error(&r)) {
+        place_msg(&vals, type, strings, true, p);
+    }
+
+    return map_mpack_err(mpack_reader_destroy(&r));
+}
+
+
+WRPcode wrp_peek(const void *data, size_t len, wrp_peek_t *peek)
+{
+    const uint32_t wanted = WRP_FIELD_BIT(WRP_FIELD__MSG_TYPE)
+                          | WRP_FIELD_BIT(WRP_FIELD__SOURCE)
+                          | WRP_FIELD_BIT(WRP_FIELD__DEST)
+                          | WRP_FIELD_BIT(WRP_FIELD__TRANS_ID);
+    struct values vals;
+    mpack_reader_t r;
+    wrp_peek_t tmp;
+
+    if (!data || !len || !peek) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    memset(&tmp, 0, sizeof(tmp));
+
+    mpack_reader_init_data(&r, (const char *) data, len);
+    read_root(&r, wanted, &vals);
+    get_msg_type(&vals, &tmp.msg_type);
+
+    if (mpack_ok == mpack_reader_error(&r)) {
+        switch (tmp.msg_type) {
+            case WRP_MSG_TYPE__REQ:
+            case WRP_MSG_TYPE__CREATE:
+            case WRP_MSG_TYPE__RETRIEVE:
+            case WRP_MSG_TYPE__UPDATE:
+            case WRP_MSG_TYPE__DELETE:
+                rd_str__(&vals, REQUIRED, &WRP_TRANS_ID, &tmp.trans_id);
+                /* fall through */
+            case WRP_MSG_TYPE__EVENT:
+                rd_str__(&vals, REQUIRED, &WRP_SOURCE__, &tmp.source);
+                rd_str__(&vals, REQUIRED, &WRP_DEST____, &tmp.dest);
+                break;
+
+            case WRP_MSG_TYPE__AUTH:
+            case WRP_MSG_TYPE__SVC_REG:
+            case WRP_MSG_TYPE__SVC_ALIVE:
+                break;
+
+            default:
+                mpack_reader_flag_error(&r, mpack_error_data);
+        }
+    }
+
+    if (mpack_ok != mpack_reader_error(&r)) {
+        return map_mpack_err(mpack_reader_destroy(&r));
+    }
+    mpack_reader_destroy(&r);
+
+    *peek = tmp;
+
+    return WRPE_OK;
+}
+
+
+WRPcode wrp_from_msgpack_reader(const void *data, size_t len, wrp_msg_t **msg)
+{
+    if (!data || !len || !msg) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    return decode(data, len, NULL, 0, msg);
+}
+
+
+WRPcode wrp_from_msgpack_arena(const void *data, size_t len, void *arena,
+                               size_t arena_len, wrp_msg_t **msg)
+{
+    if (!data || !len || !arena || !msg) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    return decode(data, len, arena, arena_len, msg);
+}
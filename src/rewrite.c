@@ -0,0 +1,236 @@
+/* SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "internal.h"
+#include "wrp-c.h"
+
+/*----------------------------------------------------------------------------*/
+/*                               Data Structures                              */
+/*----------------------------------------------------------------------------*/
+
+/* Where the string value of a field is in the encoding. */
+struct span {
+    size_t at;  /* The offset of the value's header. */
+    size_t len; /* The length of the header and the string. */
+};
+
+/*----------------------------------------------------------------------------*/
+/*                             Internal functions                             */
+/*----------------------------------------------------------------------------*/
+static uint32_t be(const uint8_t *p, size_t n)
+{
+    uint32_t v = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        v = (v << 8) | p[i];
+    }
+
+    return v;
+}
+
+
+/* Gets the string at p, returning false if it isn't a complete string. */
+static bool get_str(const uint8_t *p, size_t len, const char **s, size_t *s_len)
+{
+    size_t hdr;
+
+    if (!len) {
+        return false;
+    }
+
+    if ((0xa0 <= p[0]) && (p[0] <= 0xbf)) {
+        hdr    = 1;
+        *s_len = p[0] & 0x1f;
+    } else if ((0xd9 <= p[0]) && (p[0] <= 0xdb)) {
+        hdr = (size_t) 1 << (p[0] - 0xd9);
+        if (len < (1 + hdr)) {
+            return false;
+        }
+        *s_len = be(&p[1], hdr);
+        hdr++;
+    } else {
+        return false;
+    }
+
+    if ((len - hdr) < *s_len) {
+        return false;
+    }
+    *s = (const char *) &p[hdr];
+
+    return true;
+}
+
+
+static size_t put_str_hdr(uint8_t *p, size_t len)
+{
+    if (len <= 31) {
+        p[0] = (uint8_t) (0xa0 | len);
+        return 1;
+    }
+
+    if (len <= UINT8_MAX) {
+        p[0] = 0xd9;
+        p[1] = (uint8_t) len;
+        return 2;
+    }
+
+    if (len <= UINT16_MAX) {
+        p[0] = 0xda;
+        p[1] = (uint8_t) (len >> 8);
+        p[2] = (uint8_t) len;
+        return 3;
+    }
+
+    p[0] = 0xdb;
+    p[1] = (uint8_t) (len >> 24);
+    p[2] = (uint8_t) (len >> 16);
+    p[3] = (uint8_t) (len >> 8);
+    p[4] = (uint8_t) len;
+    return 5;
+}
+
+
+/* Returns the length of the msgpack object at p. */
+static WRPcode object_len(const uint8_t *p, size_t len, size_t *used)
+{
+    struct frame_scanner sc = { 0, 0 };
+
+    if (FRAME__DONE != frame_scan(&sc, p, len, used)) {
+        return WRPE_NOT_MSGPACK_FORMAT;
+    }
+
+    return WRPE_OK;
+}
+
+
+/* Finds the string value of the field in the top level map. */
+static WRPcode find_field(const uint8_t *p, size_t len, enum wrp_field field,
+                          struct span *span)
+{
+    size_t count;
+    size_t at;
+
+    if (!len) {
+        return WRPE_NOT_MSGPACK_FORMAT;
+    }
+
+    if ((0x80 <= p[0]) && (p[0] <= 0x8f)) {
+        count = p[0] & 0x0f;
+        at    = 1;
+    } else if ((0xde == p[0]) && (3 <= len)) {
+        count = be(&p[1], 2);
+        at    = 3;
+    } else if ((0xdf == p[0]) && (5 <= len)) {
+        count = be(&p[1], 4);
+        at    = 5;
+    } else {
+        return WRPE_NOT_A_WRP_MSG;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const struct wrp_token *token = NULL;
+        const char *key;
+        size_t key_len;
+        size_t used;
+
+        if (WRPE_OK != object_len(&p[at], len - at, &used)) {
+            return WRPE_NOT_MSGPACK_FORMAT;
+        }
+        if (get_str(&p[at], used, &key, &key_len)) {
+            token = wrp_token_find(key, key_len);
+        }
+        at += used;
+
+        if (WRPE_OK != object_len(&p[at], len - at, &used)) {
+            return WRPE_NOT_MSGPACK_FORMAT;
+        }
+
+        if (token && (field == token->id)) {
+            const char *s;
+            size_t s_len;
+
+            if (!get_str(&p[at], used, &s, &s_len)) {
+                return WRPE_NOT_A_WRP_MSG;
+            }
+
+            span->at  = at;
+            span->len = used;
+            return WRPE_OK;
+        }
+        at += used;
+    }
+
+    /* The field isn't there to rewrite. */
+    return WRPE_NOT_A_WRP_MSG;
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+WRPcode wrp_rewrite_field(const void *src, size_t len, enum wrp_field field,
+                          const char *value, size_t value_len, uint8_t **dest,
+                          size_t *dest_len)
+{
+    const uint8_t *from = (const uint8_t *) src;
+    struct span span;
+    uint8_t hdr[5];
+    size_t hdr_len;
+    size_t tail;
+    size_t total;
+    uint8_t *to;
+    WRPcode rv;
+
+    if (!src || (!value && value_len) || (UINT32_MAX < value_len) || !dest
+        || !dest_len)
+    {
+        return WRPE_INVALID_ARGS;
+    }
+
+    rv = find_field(from, len, field, &span);
+    if (WRPE_OK != rv) {
+        return rv;
+    }
+
+    hdr_len = put_str_hdr(hdr, value_len);
+    tail    = len - span.at - span.len;
+    total   = span.at + hdr_len + value_len + tail;
+
+    if (*dest) {
+        if (*dest_len < total) {
+            return WRPE_MSG_TOO_BIG;
+        }
+        to = *dest;
+    } else {
+        to = malloc(total);
+        if (!to) {
+            return WRPE_OUT_OF_MEMORY;
+        }
+    }
+
+    /* In place only the tail moves, and only if the length changes. */
+    if (to == from) {
+        if ((hdr_len + value_len) != span.len) {
+            memmove(&to[span.at + hdr_len + value_len], &from[span.at + span.len], tail);
+        }
+    } else {
+        memcpy(to, from, span.at);
+        memcpy(&to[span.at + hdr_len + value_len], &from[span.at + span.len], tail);
+    }
+
+    memcpy(&to[span.at], hdr, hdr_len);
+    if (value_len) {
+        memcpy(&to[span.at + hdr_len], value, value_len);
+    }
+
+    *dest     = to;
+    *dest_len = total;
+
+    return WRPE_OK;
+}
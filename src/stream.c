@@ -0,0 +1,186 @@
+/* SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "wrp-c.h"
+
+/*----------------------------------------------------------------------------*/
+/*                               Data Structures                              */
+/*----------------------------------------------------------------------------*/
+struct wrp_stream {
+    wrp_stream_fn fn;
+    void *ctx;
+    size_t max_len;
+
+    wrp_decoder_t *dec;
+    struct frame_scanner sc;
+
+    /* The start of a frame that didn't fit in a single feed. */
+    uint8_t *buf;
+    size_t size;
+    size_t used;
+    size_t scanned;
+};
+
+/*----------------------------------------------------------------------------*/
+/*                             Internal functions                             */
+/*----------------------------------------------------------------------------*/
+static void emit(wrp_stream_t *s, const uint8_t *data, size_t len)
+{
+    wrp_msg_t *msg = NULL;
+    WRPcode rv;
+
+    rv = wrp_decoder_decode(s->dec, data, len, &msg);
+    s->fn(s->ctx, rv, (WRPE_OK == rv) ? msg : NULL);
+}
+
+
+static void drop(wrp_stream_t *s)
+{
+    memset(&s->sc, 0, sizeof(s->sc));
+    s->used    = 0;
+    s->scanned = 0;
+}
+
+
+static WRPcode hold(wrp_stream_t *s, const uint8_t *data, size_t len)
+{
+    if (s->size < (s->used + len)) {
+        size_t size = s->size ? s->size : 256;
+        uint8_t *tmp;
+
+        while (size < (s->used + len)) {
+            size *= 2;
+        }
+
+        tmp = realloc(s->buf, size);
+        if (!tmp) {
+            drop(s);
+            return WRPE_OUT_OF_MEMORY;
+        }
+        s->buf  = tmp;
+        s->size = size;
+    }
+
+    memcpy(&s->buf[s->used], data, len);
+    s->used += len;
+
+    return WRPE_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+WRPcode wrp_stream_create(wrp_stream_t **stream, size_t max_len,
+                          wrp_stream_fn fn, void *ctx)
+{
+    wrp_stream_t *s;
+    WRPcode rv;
+
+    if (!stream || !max_len || !fn) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    s = calloc(1, sizeof(wrp_stream_t));
+    if (!s) {
+        return WRPE_OUT_OF_MEMORY;
+    }
+
+    rv = wrp_decoder_create(&s->dec);
+    if (WRPE_OK != rv) {
+        free(s);
+        return rv;
+    }
+
+    s->fn      = fn;
+    s->ctx     = ctx;
+    s->max_len = max_len;
+    *stream    = s;
+
+    return WRPE_OK;
+}
+
+
+WRPcode wrp_stream_feed(wrp_stream_t *s, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *) data;
+    enum frame_status status;
+    size_t used;
+    WRPcode rv;
+
+    if (!s || (!data && len)) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    /* Finish the frame that is already started first.  Only as much as the
+     * largest frame allowed is copied, the rest stays where it is. */
+    if (s->used) {
+        size_t before = s->used;
+        size_t room   = s->max_len - s->used;
+
+        rv = hold(s, p, (len < room) ? len : room);
+        if (WRPE_OK != rv) {
+            return rv;
+        }
+
+        status = frame_scan(&s->sc, &s->buf[s->scanned], s->used - s->scanned, &used);
+        s->scanned += used;
+        if (FRAME__INVALID == status) {
+            drop(s);
+            return WRPE_NOT_MSGPACK_FORMAT;
+        }
+        if (FRAME__MORE == status) {
+            if (s->max_len == s->used) {
+                drop(s);
+                return WRPE_MSG_TOO_BIG;
+            }
+            return WRPE_OK;
+        }
+
+        emit(s, s->buf, s->scanned);
+
+        /* The rest of the data is decoded where it is. */
+        p += s->scanned - before;
+        len -= s->scanned - before;
+        drop(s);
+    }
+
+    while (len) {
+        status = frame_scan(&s->sc, p, len, &used);
+        if (FRAME__INVALID == status) {
+            drop(s);
+            return WRPE_NOT_MSGPACK_FORMAT;
+        }
+        if ((FRAME__MORE == status) && (len < s->max_len)) {
+            s->scanned = used;
+            return hold(s, p, len);
+        }
+        if ((FRAME__MORE == status) || (s->max_len < used)) {
+            drop(s);
+            return WRPE_MSG_TOO_BIG;
+        }
+
+        emit(s, p, used);
+        p += used;
+        len -= used;
+    }
+
+    return WRPE_OK;
+}
+
+
+void wrp_stream_destroy(wrp_stream_t *s)
+{
+    if (!s) {
+        return;
+    }
+
+    wrp_decoder_destroy(s->dec);
+    free(s->buf);
+    free(s);
+}
@@ -18,9 +18,13 @@
 /*----------------------------------------------------------------------------*/
 /*                               Data Structures                              */
 /*----------------------------------------------------------------------------*/
-struct wrp_str {
+
+/* Output is written while it fits, but the full length is always counted so
+ * the same pass can size the output or fill it. */
+struct out {
+    char *buf;
+    size_t size;
     size_t len;
-    char *s;
 };
 
 /*----------------------------------------------------------------------------*/
@@ -37,339 +41,285 @@ struct wrp_str {
 /*----------------------------------------------------------------------------*/
 /*                             Internal functions                             */
 /*----------------------------------------------------------------------------*/
-static void string_list_to_string(const struct wrp_string_list *list, char **dst, size_t *len)
+static void put(struct out *o, const char *s, size_t len)
 {
-    char *p           = NULL;
-    const char *nl    = "\n";
-    const char *comma = ",";
-
-    *dst = NULL;
-    *len = 0;
+    if (o->len < o->size) {
+        size_t room = o->size - o->len;
 
-    for (size_t i = 0; i < list->count; i++) {
-        if (i == (list->count - 1)) {
-            comma = "";
-        }
-        p  = mlaprintf(len, "%s%.*s        '%.*s'%s\n", nl, (int) *len, *dst,
-                       (int) list->list[i].len, list->list[i].s, comma);
-        nl = "";
-        free(*dst);
-        *dst = p;
-        if (!*dst) {
-            return;
-        }
-    }
-
-    if (0 < *len) {
-        p = mlaprintf(len, "%s    ", *dst);
-        free(*dst);
-        *dst = p;
+        memcpy(&o->buf[o->len], s, (len < room) ? len : room);
     }
+    o->len += len;
 }
 
 
-static void nvp_list_to_string(const struct wrp_nvp_list *list, char **dst, size_t *len)
+static void put_s(struct out *o, const char *s)
 {
-    char *p        = NULL;
-    const char *nl = "\n";
-
-    *dst = NULL;
-    *len = 0;
-
-    for (size_t i = 0; i < list->count; i++) {
-        p  = mlaprintf(len, "%s%.*s        .%.*s: '%.*s'\n", nl, (int) *len, *dst,
-                       (int) list->list[i].name.len, list->list[i].name.s,
-                       (int) list->list[i].value.len, list->list[i].value.s);
-        nl = "";
-        free(*dst);
-        *dst = p;
-        if (!*dst) {
-            return;
-        }
-    }
-
-    if (0 < *len) {
-        p = mlaprintf(len, "%s    ", *dst);
-        free(*dst);
-        *dst = p;
-    }
+    put(o, s, strlen(s));
 }
 
 
-static WRPcode auth_to_string(const wrp_msg_t *msg, char **dst, size_t *len)
+static void put_ws(struct out *o, const struct wrp_string *s)
 {
-    size_t _len;
-    WRPcode rv = WRPE_OUT_OF_MEMORY;
-
-    *dst = mlaprintf(&_len,
-                     "wrp_auth_msg {\n"
-                     "    .status = '%.*d'\n"
-                     "}\n",
-                     (msg->u.auth.status.num) ? 1 : 0,
-                     (msg->u.auth.status.num) ? *msg->u.auth.status.num : 0);
-
-    if (NULL != *dst) {
-        *len = _len;
-        rv   = WRPE_OK;
+    if (s->len) {
+        put(o, s->s, s->len);
     }
-
-    return rv;
 }
 
 
-static WRPcode req_to_string(const wrp_msg_t *msg, char **dst, size_t *len)
+static void put_str(struct out *o, const char *label, const struct wrp_string *s)
 {
-    WRPcode rv                    = WRPE_OUT_OF_MEMORY;
-    const struct wrp_req_msg *req = &msg->u.req;
-    struct wrp_str headers        = { 0, NULL };
-    struct wrp_str partners       = { 0, NULL };
-    struct wrp_str metadata       = { 0, NULL };
-    size_t _len                   = 0;
+    put_s(o, label);
+    put(o, "'", 1);
+    put_ws(o, s);
+    put(o, "'\n", 2);
+}
 
-    string_list_to_string(&req->headers, &headers.s, &headers.len);
-    string_list_to_string(&req->partner_ids, &partners.s, &partners.len);
-    nvp_list_to_string(&req->metadata, &metadata.s, &metadata.len);
 
-    *dst = mlaprintf(&_len,
-                     "wrp_req_msg {\n"
-                     "    .dest          = '%.*s'\n"
-                     "    .payload (len) = %zd\n"
-                     "    .source        = '%.*s'\n"
-                     "    .trans_id      = '%.*s'\n"
-                     "     - - optional - -\n"
-                     "    .accept        = '%.*s'\n"
-                     "    .content_type  = '%.*s'\n"
-                     "    .headers       = [%.*s]\n"
-                     "    .metadata      = {%.*s}\n"
-                     "    .msg_id        = '%.*s'\n"
-                     "    .partner_ids   = [%.*s]\n"
-                     "    .rdr           = '%.*d'\n"
-                     "    .session_id    = '%.*s'\n"
-                     "    .status        = '%.*d'\n"
-                     "}\n",
-                     (int) req->dest.len, req->dest.s,
-                     req->payload.len,
-                     (int) req->source.len, req->source.s,
-                     (int) req->trans_id.len, req->trans_id.s,
-
-                     (int) req->accept.len, req->accept.s,
-                     (int) req->content_type.len, req->content_type.s,
-                     (int) headers.len, headers.s,
-                     (int) metadata.len, metadata.s,
-                     (int) req->msg_id.len, req->msg_id.s,
-                     (int) partners.len, partners.s,
-                     (req->rdr.num) ? 1 : 0, (req->rdr.num) ? *req->rdr.num : 0,
-                     (int) req->session_id.len, req->session_id.s,
-                     (req->status.num) ? 1 : 0, (req->status.num) ? *req->status.num : 0);
+static void put_int(struct out *o, const char *label, const struct wrp_int *i)
+{
+    char num[24];
 
-    if (NULL != *dst) {
-        *len = _len;
-        rv   = WRPE_OK;
+    put_s(o, label);
+    put(o, "'", 1);
+    if (i->num) {
+        snprintf(num, sizeof(num), "%d", *i->num);
+        put_s(o, num);
     }
-
-    if (headers.s) free(headers.s);
-    if (partners.s) free(partners.s);
-    if (metadata.s) free(metadata.s);
-
-    return rv;
+    put(o, "'\n", 2);
 }
 
 
-static WRPcode event_to_string(const wrp_msg_t *msg, char **dst, size_t *len)
+static void put_len(struct out *o, const char *label, size_t len)
 {
-    WRPcode rv                        = WRPE_OUT_OF_MEMORY;
-    const struct wrp_event_msg *event = &msg->u.event;
-    struct wrp_str headers            = { 0, NULL };
-    struct wrp_str partners           = { 0, NULL };
-    struct wrp_str metadata           = { 0, NULL };
-    size_t _len                       = 0;
+    char num[24];
 
-    string_list_to_string(&event->headers, &headers.s, &headers.len);
-    string_list_to_string(&event->partner_ids, &partners.s, &partners.len);
-    nvp_list_to_string(&event->metadata, &metadata.s, &metadata.len);
-
-    *dst = mlaprintf(&_len,
-                     "wrp_event_msg {\n"
-                     "    .dest          = '%.*s'\n"
-                     "    .source        = '%.*s'\n"
-                     "     - - optional - -\n"
-                     "    .content_type  = '%.*s'\n"
-                     "    .headers       = [%.*s]\n"
-                     "    .metadata      = {%.*s}\n"
-                     "    .msg_id        = '%.*s'\n"
-                     "    .partner_ids   = [%.*s]\n"
-                     "    .payload (len) = %zd\n"
-                     "    .session_id    = '%.*s'\n"
-                     "}\n",
-                     (int) event->dest.len, event->dest.s,
-                     (int) event->source.len, event->source.s,
+    put_s(o, label);
+    snprintf(num, sizeof(num), "%zu", len);
+    put_s(o, num);
+    put(o, "\n", 1);
+}
 
-                     (int) event->content_type.len, event->content_type.s,
-                     (int) headers.len, headers.s,
-                     (int) metadata.len, metadata.s,
-                     (int) event->msg_id.len, event->msg_id.s,
-                     (int) partners.len, partners.s,
-                     event->payload.len,
-                     (int) event->session_id.len, event->session_id.s);
 
-    if (NULL != *dst) {
-        *len = _len;
-        rv   = WRPE_OK;
+static void put_slist(struct out *o, const char *label, const struct wrp_string_list *l)
+{
+    put_s(o, label);
+    put(o, "[", 1);
+    if (l->count) {
+        put(o, "\n", 1);
+        for (size_t i = 0; i < l->count; i++) {
+            put(o, "        '", 9);
+            put_ws(o, &l->list[i]);
+            put_s(o, (i == (l->count - 1)) ? "'\n" : "',\n");
+        }
+        put(o, "    ", 4);
     }
-
-    if (headers.s) free(headers.s);
-    if (partners.s) free(partners.s);
-    if (metadata.s) free(metadata.s);
-
-    return rv;
+    put(o, "]\n", 2);
 }
 
 
-static WRPcode crud_to_string(const wrp_msg_t *msg, char **dst, size_t *len,
-                              const char *type)
+static void put_nvpl(struct out *o, const char *label, const struct wrp_nvp_list *l)
 {
-    WRPcode rv                      = WRPE_OUT_OF_MEMORY;
-    const struct wrp_crud_msg *crud = &msg->u.crud;
-    struct wrp_str headers          = { 0, NULL };
-    struct wrp_str partners         = { 0, NULL };
-    struct wrp_str metadata         = { 0, NULL };
-    size_t _len                     = 0;
-
-    string_list_to_string(&crud->headers, &headers.s, &headers.len);
-    string_list_to_string(&crud->partner_ids, &partners.s, &partners.len);
-    nvp_list_to_string(&crud->metadata, &metadata.s, &metadata.len);
-
-    *dst = mlaprintf(&_len,
-                     "wrp_crud_msg (%s) {\n"
-                     "    .dest          = '%.*s'\n"
-                     "    .source        = '%.*s'\n"
-                     "    .trans_id      = '%.*s'\n"
-                     "     - - optional - -\n"
-                     "    .accept        = '%.*s'\n"
-                     "    .content_type  = '%.*s'\n"
-                     "    .headers       = [%.*s]\n"
-                     "    .metadata      = {%.*s}\n"
-                     "    .msg_id        = '%.*s'\n"
-                     "    .partner_ids   = [%.*s]\n"
-                     "    .path          = '%.*s'\n"
-                     "    .payload (len) = %zd\n"
-                     "    .rdr           = '%.*d'\n"
-                     "    .session_id    = '%.*s'\n"
-                     "    .status        = '%.*d'\n"
-                     "}\n",
-                     type,
-                     (int) crud->dest.len, crud->dest.s,
-                     (int) crud->source.len, crud->source.s,
-                     (int) crud->trans_id.len, crud->trans_id.s,
-                     (int) crud->accept.len, crud->accept.s,
-                     (int) crud->content_type.len, crud->content_type.s,
-                     (int) headers.len, headers.s,
-                     (int) metadata.len, metadata.s,
-                     (int) crud->msg_id.len, crud->msg_id.s,
-                     (int) partners.len, partners.s,
-                     (int) crud->path.len, crud->path.s,
-                     crud->payload.len,
-                     (crud->rdr.num) ? 1 : 0, (crud->rdr.num) ? *crud->rdr.num : 0,
-                     (int) crud->session_id.len, crud->session_id.s,
-                     (crud->status.num) ? 1 : 0, (crud->status.num) ? *crud->status.num : 0);
-
-    if (NULL != *dst) {
-        *len = _len;
-        rv   = WRPE_OK;
+    put_s(o, label);
+    put(o, "{", 1);
+    if (l->count) {
+        put(o, "\n", 1);
+        for (size_t i = 0; i < l->count; i++) {
+            put(o, "        .", 9);
+            put_ws(o, &l->list[i].name);
+            put(o, ": '", 3);
+            put_ws(o, &l->list[i].value);
+            put(o, "'\n", 2);
+        }
+        put(o, "    ", 4);
     }
-
-    if (headers.s) free(headers.s);
-    if (partners.s) free(partners.s);
-    if (metadata.s) free(metadata.s);
-
-    return rv;
+    put(o, "}\n", 2);
 }
 
 
-static WRPcode reg_to_string(const wrp_msg_t *msg, char **dst, size_t *len)
+static void auth_to_string(struct out *o, const wrp_msg_t *msg)
 {
-    WRPcode rv                        = WRPE_OUT_OF_MEMORY;
-    const struct wrp_svc_reg_msg *reg = &msg->u.reg;
-    size_t _len                       = 0;
+    put_s(o, "wrp_auth_msg {\n");
+    put_int(o, "    .status = ", &msg->u.auth.status);
+    put_s(o, "}\n");
+}
 
-    *dst = mlaprintf(&_len,
-                     "wrp_svc_reg_msg {\n"
-                     "    .service_name = '%.*s'\n"
-                     "    .url          = '%.*s'\n"
-                     "}\n",
-                     (int) reg->service_name.len, reg->service_name.s,
-                     (int) reg->url.len, reg->url.s);
 
-    if (NULL != *dst) {
-        *len = _len;
-        rv   = WRPE_OK;
-    }
+static void req_to_string(struct out *o, const wrp_msg_t *msg)
+{
+    const struct wrp_req_msg *req = &msg->u.req;
 
-    return rv;
+    put_s(o, "wrp_req_msg {\n");
+    put_str(o, "    .dest          = ", &req->dest);
+    put_len(o, "    .payload (len) = ", req->payload.len);
+    put_str(o, "    .source        = ", &req->source);
+    put_str(o, "    .trans_id      = ", &req->trans_id);
+    put_s(o, "     - - optional - -\n");
+    put_str(o, "    .accept        = ", &req->accept);
+    put_str(o, "    .content_type  = ", &req->content_type);
+    put_slist(o, "    .headers       = ", &req->headers);
+    put_nvpl(o, "    .metadata      = ", &req->metadata);
+    put_str(o, "    .msg_id        = ", &req->msg_id);
+    put_slist(o, "    .partner_ids   = ", &req->partner_ids);
+    put_int(o, "    .rdr           = ", &req->rdr);
+    put_str(o, "    .session_id    = ", &req->session_id);
+    put_int(o, "    .status        = ", &req->status);
+    put_s(o, "}\n");
 }
 
 
-static WRPcode keep_alive_to_string(const wrp_msg_t *msg, char **dst, size_t *len)
+static void event_to_string(struct out *o, const wrp_msg_t *msg)
 {
-    size_t _len;
-    WRPcode rv = WRPE_OUT_OF_MEMORY;
+    const struct wrp_event_msg *event = &msg->u.event;
 
-    (void) msg;
+    put_s(o, "wrp_event_msg {\n");
+    put_str(o, "    .dest          = ", &event->dest);
+    put_str(o, "    .source        = ", &event->source);
+    put_s(o, "     - - optional - -\n");
+    put_str(o, "    .content_type  = ", &event->content_type);
+    put_slist(o, "    .headers       = ", &event->headers);
+    put_nvpl(o, "    .metadata      = ", &event->metadata);
+    put_str(o, "    .msg_id        = ", &event->msg_id);
+    put_slist(o, "    .partner_ids   = ", &event->partner_ids);
+    put_len(o, "    .payload (len) = ", event->payload.len);
+    put_str(o, "    .session_id    = ", &event->session_id);
+    put_s(o, "}\n");
+}
 
-    *dst = mlaprintf(&_len, "wrp_keep_alive_msg {}\n");
-    if (NULL != *dst) {
-        *len = _len;
-        rv   = WRPE_OK;
-    }
 
-    return rv;
+static void crud_to_string(struct out *o, const wrp_msg_t *msg, const char *type)
+{
+    const struct wrp_crud_msg *crud = &msg->u.crud;
+
+    put_s(o, "wrp_crud_msg (");
+    put_s(o, type);
+    put_s(o, ") {\n");
+    put_str(o, "    .dest          = ", &crud->dest);
+    put_str(o, "    .source        = ", &crud->source);
+    put_str(o, "    .trans_id      = ", &crud->trans_id);
+    put_s(o, "     - - optional - -\n");
+    put_str(o, "    .accept        = ", &crud->accept);
+    put_str(o, "    .content_type  = ", &crud->content_type);
+    put_slist(o, "    .headers       = ", &crud->headers);
+    put_nvpl(o, "    .metadata      = ", &crud->metadata);
+    put_str(o, "    .msg_id        = ", &crud->msg_id);
+    put_slist(o, "    .partner_ids   = ", &crud->partner_ids);
+    put_str(o, "    .path          = ", &crud->path);
+    put_len(o, "    .payload (len) = ", crud->payload.len);
+    put_int(o, "    .rdr           = ", &crud->rdr);
+    put_str(o, "    .session_id    = ", &crud->session_id);
+    put_int(o, "    .status        = ", &crud->status);
+    put_s(o, "}\n");
 }
 
 
-WRPcode wrp_to_string(const wrp_msg_t *msg, char **dst, size_t *len)
+static void reg_to_string(struct out *o, const wrp_msg_t *msg)
 {
-    size_t _len = 0;
-    WRPcode rv  = WRPE_OK;
+    const struct wrp_svc_reg_msg *reg = &msg->u.reg;
 
-    if (!msg || !dst) {
-        return WRPE_INVALID_ARGS;
-    }
+    put_s(o, "wrp_svc_reg_msg {\n");
+    put_str(o, "    .service_name = ", &reg->service_name);
+    put_str(o, "    .url          = ", &reg->url);
+    put_s(o, "}\n");
+}
 
+
+static WRPcode msg_to_string(struct out *o, const wrp_msg_t *msg)
+{
     switch (msg->msg_type) {
         case WRP_MSG_TYPE__AUTH:
-            rv = auth_to_string(msg, dst, &_len);
+            auth_to_string(o, msg);
             break;
         case WRP_MSG_TYPE__REQ:
-            rv = req_to_string(msg, dst, &_len);
+            req_to_string(o, msg);
             break;
         case WRP_MSG_TYPE__EVENT:
-            rv = event_to_string(msg, dst, &_len);
+            event_to_string(o, msg);
             break;
         case WRP_MSG_TYPE__CREATE:
-            rv = crud_to_string(msg, dst, &_len, "CREATE");
+            crud_to_string(o, msg, "CREATE");
             break;
         case WRP_MSG_TYPE__RETRIEVE:
-            rv = crud_to_string(msg, dst, &_len, "RETRIEVE");
+            crud_to_string(o, msg, "RETRIEVE");
             break;
         case WRP_MSG_TYPE__UPDATE:
-            rv = crud_to_string(msg, dst, &_len, "UPDATE");
+            crud_to_string(o, msg, "UPDATE");
             break;
         case WRP_MSG_TYPE__DELETE:
-            rv = crud_to_string(msg, dst, &_len, "DELETE");
+            crud_to_string(o, msg, "DELETE");
             break;
         case WRP_MSG_TYPE__SVC_REG:
-            rv = reg_to_string(msg, dst, &_len);
+            reg_to_string(o, msg);
             break;
         case WRP_MSG_TYPE__SVC_ALIVE:
-            rv = keep_alive_to_string(msg, dst, &_len);
+            put_s(o, "wrp_keep_alive_msg {}\n");
             break;
         default:
-            rv = WRPE_NOT_A_WRP_MSG;
-            break;
+            return WRPE_NOT_A_WRP_MSG;
+    }
+
+    return WRPE_OK;
+}
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+WRPcode wrp_to_string(const wrp_msg_t *msg, char **dst, size_t *len)
+{
+    struct out o = { NULL, 0, 0 };
+    WRPcode rv;
+
+    if (!msg || !dst) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    /* Size it, then fill it in. */
+    rv = msg_to_string(&o, msg);
+    if (WRPE_OK != rv) {
+        if (len) {
+            *len = 0;
+        }
+        return rv;
+    }
+
+    o.size = o.len + 1;
+    o.len  = 0;
+    o.buf  = malloc(o.size);
+    if (!o.buf) {
+        return WRPE_OUT_OF_MEMORY;
     }
 
+    msg_to_string(&o, msg);
+    o.buf[o.len] = '\0';
+
+    *dst = o.buf;
     if (len) {
-        *len = _len;
+        *len = o.len;
+    }
+
+    return WRPE_OK;
+}
+
+
+WRPcode wrp_to_string_buf(const wrp_msg_t *msg, char *buf, size_t size, size_t *len)
+{
+    struct out o = { buf, size, 0 };
+    WRPcode rv;
+
+    if (!msg || (!buf && size)) {
+        return WRPE_INVALID_ARGS;
+    }
+
+    rv = msg_to_string(&o, msg);
+
+    if (size) {
+        buf[(o.len < size) ? o.len : (size - 1)] = '\0';
+    }
+    if (len) {
+        *len = o.len;
+    }
+
+    if ((WRPE_OK == rv) && (size <= o.len)) {
+        rv = WRPE_MSG_TOO_BIG;
     }
 
     return rv;
@@ -0,0 +1,52 @@
+/* SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include "test_common.h"
+
+/* Test that a duplicated key the message type doesn't use is ignored. */
+
+// clang-format off
+const struct test_vector test = {
+    .wrp_from_msgpack_rv = WRPE_OK,
+    .wrp_to_msgpack_rv   = WRPE_OK,
+    .wrp_to_string_rv    = WRPE_OK,
+
+    .in.msg_type                 = 4,
+    .in.u.event.source.s         = "source-address",
+    .in.u.event.source.len       = 14,
+    .in.u.event.dest.s           = "dest-address",
+    .in.u.event.dest.len         = 12,
+
+    .string = "wrp_event_msg {\n"
+              "    .dest          = 'dest-address'\n"
+              "    .source        = 'source-address'\n"
+              "     - - optional - -\n"
+              "    .content_type  = ''\n"
+              "    .headers       = []\n"
+              "    .metadata      = {}\n"
+              "    .msg_id        = ''\n"
+              "    .partner_ids   = []\n"
+              "    .payload (len) = 0\n"
+              "    .session_id    = ''\n"
+              "}\n",
+
+    .asymetric_active      = true,
+    .asymetric_msgpack_len = 51,
+    .asymetric_msgpack =
+        "\x83"  /* 3 name value pairs */
+            "\xa8""msg_type"         /* : */ "\x04" // 4
+            "\xa4""dest"             /* : */ "\xac""dest-address"
+            "\xa6""source"           /* : */ "\xae""source-address",
+
+    .msgpack_len = 69,
+    .msgpack =
+        "\x85"  /* 5 name value pairs */
+            "\xa8""msg_type"         /* : */ "\x04" // 4
+            "\xa4""dest"             /* : */ "\xac""dest-address"
+            "\xa6""source"           /* : */ "\xae""source-address"
+            "\xa3""url"              /* : */ "\xa4""url1"
+            "\xa3""url"              /* : */ "\xa4""url2"
+};
+// clang-format on
+
+const char *test_name = __FILE__;
@@ -0,0 +1,153 @@
+/*
+ * SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <CUnit/Basic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "wrp-c.h"
+
+static char *write_capture(const uint8_t *data, size_t len)
+{
+    static char path[] = "wrp-capture-XXXXXX";
+    int fd;
+
+    strcpy(path, "wrp-capture-XXXXXX");
+    fd = mkstemp(path);
+    CU_ASSERT_FATAL(0 <= fd);
+    CU_ASSERT_FATAL(len == (size_t) write(fd, data, len));
+    close(fd);
+
+    return path;
+}
+
+static size_t make_event(const char *dest, uint8_t *buf, size_t size)
+{
+    wrp_msg_t msg;
+    uint8_t *out = buf;
+    size_t len   = size;
+
+    memset(&msg, 0, sizeof(wrp_msg_t));
+    msg.msg_type             = WRP_MSG_TYPE__EVENT;
+    msg.u.event.source.s     = "mac:112233445566";
+    msg.u.event.source.len   = strlen(msg.u.event.source.s);
+    msg.u.event.dest.s       = dest;
+    msg.u.event.dest.len     = strlen(dest);
+    msg.u.event.payload.data = (const uint8_t *) "payload";
+    msg.u.event.payload.len  = 7;
+
+    CU_ASSERT_FATAL(WRPE_OK == wrp_to_msgpack(&msg, &out, &len));
+
+    return len;
+}
+
+void test_01(void)
+{
+    const char *dests[] = { "event:one", "event:two", "event:three" };
+    wrp_capture_t *cap = NULL;
+    wrp_msg_t *msg     = NULL;
+    size_t len         = 0;
+    uint8_t buf[1024];
+    const void *data;
+    size_t data_len;
+    size_t partial;
+    char *path;
+
+    for (size_t i = 0; i < 3; i++) {
+        len += make_event(dests[i], &buf[len], sizeof(buf) - len);
+    }
+
+    /* Leave a partial record at the end. */
+    partial = make_event("event:partial", &buf[len], sizeof(buf) - len);
+    path    = write_capture(buf, len + partial - 3);
+
+    CU_ASSERT_FATAL(WRPE_OK == wrp_capture_open(&cap, path));
+    CU_ASSERT(3 == wrp_capture_count(cap));
+
+    /* Out of order on purpose. */
+    for (size_t i = 3; 0 < i; i--) {
+        CU_ASSERT_FATAL(WRPE_OK == wrp_capture_get(cap, i - 1, &msg));
+        CU_ASSERT(WRP_MSG_TYPE__EVENT == msg->msg_type);
+        CU_ASSERT(strlen(dests[i - 1]) == msg->u.event.dest.len);
+        CU_ASSERT(0 == memcmp(dests[i - 1], msg->u.event.dest.s,
+                              msg->u.event.dest.len));
+        CU_ASSERT(WRPE_OK == wrp_destroy(msg));
+    }
+
+    CU_ASSERT(WRPE_OK == wrp_capture_record(cap, 0, &data, &data_len));
+    CU_ASSERT(0 == memcmp(buf, data, data_len));
+
+    CU_ASSERT(WRPE_INVALID_ARGS == wrp_capture_get(cap, 3, &msg));
+    CU_ASSERT(WRPE_INVALID_ARGS == wrp_capture_record(cap, 3, &data, &data_len));
+
+    wrp_capture_close(cap);
+    unlink(path);
+}
+
+void test_02(void)
+{
+    uint8_t bad[]      = { 0x80, 0xc1 };
+    wrp_capture_t *cap = NULL;
+    char *path;
+
+    CU_ASSERT(WRPE_INVALID_ARGS == wrp_capture_open(NULL, "x"));
+    CU_ASSERT(WRPE_INVALID_ARGS == wrp_capture_open(&cap, NULL));
+    CU_ASSERT(WRPE_OTHER_ERROR == wrp_capture_open(&cap, "does-not-exist"));
+    CU_ASSERT(0 == wrp_capture_count(NULL));
+
+    path = write_capture(bad, sizeof(bad));
+    CU_ASSERT(WRPE_NOT_MSGPACK_FORMAT == wrp_capture_open(&cap, path));
+    unlink(path);
+
+    /* An empty capture is valid. */
+    path = write_capture(bad, 0);
+    CU_ASSERT_FATAL(WRPE_OK == wrp_capture_open(&cap, path));
+    CU_ASSERT(0 == wrp_capture_count(cap));
+    wrp_capture_close(cap);
+    unlink(path);
+}
+
+void add_suites(CU_pSuite *suite)
+{
+    *suite = CU_add_suite("capture tests", NULL, NULL);
+    CU_add_test(*suite, "test_01", test_01);
+    CU_add_test(*suite, "test_02", test_02);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/*                             External Functions                             */
+/*----------------------------------------------------------------------------*/
+int main(void)
+{
+    unsigned rv     = 1;
+    CU_pSuite suite = NULL;
+
+    if (CUE_SUCCESS == CU_initialize_registry()) {
+        add_suites(&suite);
+
+        if (NULL != suite) {
+            CU_basic_set_mode(CU_BRM_VERBOSE);
+            CU_basic_run_tests();
+            printf("\n");
+            CU_basic_show_failures(CU_get_failure_list());
+            printf("\n\n");
+            rv = CU_get_number_of_tests_failed();
+        }
+
+        CU_cleanup_registry();
+    }
+
+    if (0 != rv) {
+        return 1;
+    }
+
+    return 0;
+}
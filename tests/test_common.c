@@ -1,10 +1,12 @@
 /* SPDX-FileCopyrightText: 2021-2022 Comcast Cable Communications Management, LLC */
 /* SPDX-License-Identifier: Apache-2.0 */
+#include <ctype.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 
 #include <CUnit/Basic.h>
 #include <cutils/xxd.h>
@@ -24,7 +26,7 @@
 /*----------------------------------------------------------------------------*/
 /*                            File Scoped Variables                           */
 /*----------------------------------------------------------------------------*/
-/* none */
+static wrp_decoder_t *decoder = NULL;
 
 /*----------------------------------------------------------------------------*/
 /*                             Function Prototypes                            */
@@ -408,6 +410,7 @@ static void test_wrp_to_msgpack_helper(uint8_t **got, size_t *len)
         }
 
         CU_ASSERT_FATAL(NULL != *got);
+        CU_ASSERT(goal_len == wrp_msgpack_size(&test.in));
         if (*len != goal_len) {
             printf("Expected: %zd, Got: %zd\n", goal_len, *len);
         }
@@ -429,12 +432,13 @@ static void test_wrp_to_msgpack_helper(uint8_t **got, size_t *len)
     }
 }
 
-static void test_wrp_from_msgpack()
+static void test_wrp_from_msgpack_helper(WRPcode (*fn)(const void *, size_t,
+                                                       wrp_msg_t **))
 {
     wrp_msg_t *got = NULL;
     WRPcode rv;
 
-    rv = wrp_from_msgpack(test.msgpack, test.msgpack_len, &got);
+    rv = fn(test.msgpack, test.msgpack_len, &got);
     if (rv != test.wrp_to_msgpack_rv) {
         printf("rv: Expected: %d, Got: %d\n", test.wrp_from_msgpack_rv, rv);
     }
@@ -447,6 +451,565 @@ static void test_wrp_from_msgpack()
 }
 
 
+/* An event with an unknown value nested depth arrays deep ahead of the
+ * fields that matter. */
+static uint8_t *deep_event(size_t depth, size_t *len)
+{
+    static const uint8_t head[] = { 0x84, 0xa1, 'x' };
+    static const uint8_t tail[] = {
+        0xc0, 0xa8, 'm', 's', 'g', '_', 't', 'y', 'p', 'e', 0x04,
+        0xa6, 's', 'o', 'u', 'r', 'c', 'e', 0xa1, 's',
+        0xa4, 'd', 'e', 's', 't', 0xa1, 'd'
+    };
+    uint8_t *buf;
+
+    *len = sizeof(head) + depth + sizeof(tail);
+    buf  = malloc(*len);
+    CU_ASSERT_FATAL(NULL != buf);
+
+    memcpy(buf, head, sizeof(head));
+    memset(&buf[sizeof(head)], 0x91, depth);
+    memcpy(&buf[sizeof(head) + depth], tail, sizeof(tail));
+
+    return buf;
+}
+
+
+static WRPcode from_msgpack_arena(const void *src, size_t len, wrp_msg_t **msg)
+{
+    /* Deliberately misaligned to make sure the arena is handled. */
+    static uint8_t arena[4097];
+
+    return wrp_from_msgpack_arena(src, len, &arena[1], sizeof(arena) - 1, msg);
+}
+
+
+static WRPcode from_msgpack_decoder(const void *src, size_t len, wrp_msg_t **msg)
+{
+    return wrp_decoder_decode(decoder, src, len, msg);
+}
+
+
+static void test_wrp_from_msgpack()
+{
+    test_wrp_from_msgpack_helper(wrp_from_msgpack);
+}
+
+
+static void test_wrp_from_msgpack_reader()
+{
+    const char empty[] = "\x83\xa8""msg_type\x04\xa6""source\xa0\xa4""dest\xa1""d";
+    wrp_msg_t *tree    = NULL;
+    wrp_msg_t *got     = NULL;
+    uint8_t *deep;
+    size_t len;
+
+    test_wrp_from_msgpack_helper(wrp_from_msgpack_reader);
+
+    /* An empty string points into the source, the same as from the tree. */
+    CU_ASSERT_FATAL(WRPE_OK == wrp_from_msgpack(empty, sizeof(empty) - 1, &tree));
+    CU_ASSERT_FATAL(WRPE_OK == wrp_from_msgpack_reader(empty, sizeof(empty) - 1,
+                                                       &got));
+    CU_ASSERT(0 == got->u.event.source.len);
+    CU_ASSERT(NULL != got->u.event.source.s);
+    CU_ASSERT(tree->u.event.source.s == got->u.event.source.s);
+    wrp_destroy(tree);
+    wrp_destroy(got);
+
+    /* Skipping an unknown value doesn't recurse, however deep it goes. */
+    deep = deep_event(1000000, &len);
+    CU_ASSERT_FATAL(WRPE_OK == wrp_from_msgpack_reader(deep, len, &got));
+    CU_ASSERT(WRP_MSG_TYPE__EVENT == got->msg_type);
+    CU_ASSERT(1 == got->u.event.dest.len);
+    CU_ASSERT('d' == got->u.event.dest.s[0]);
+    wrp_destroy(got);
+
+    /* Cut short inside the nesting is not msgpack. */
+    CU_ASSERT(WRPE_NOT_MSGPACK_FORMAT == wrp_from_msgpack_reader(deep, 1000, &got));
+    free(deep);
+}
+
+
+static void test_wrp_from_msgpack_arena()
+{
+    uint8_t arena[8];
+    wrp_msg_t *got = NULL;
+
+    test_wrp_from_msgpack_helper(from_msgpack_arena);
+
+    if (WRPE_OK == test.wrp_from_msgpack_rv) {
+        CU_ASSERT(WRPE_MSG_TOO_BIG
+                  == wrp_from_msgpack_arena(test.msgpack, test.msgpack_len,
+                                            arena, sizeof(arena), &got));
+        CU_ASSERT(NULL == got);
+    }
+}
+
+
+static WRPcode from_msgpack_ex(const void *src, size_t len, wrp_msg_t **msg)
+{
+    return wrp_from_msgpack_ex(src, len, WRP_FIELDS_ALL, msg);
+}
+
+
+static void test_wrp_from_msgpack_ex()
+{
+    const uint32_t lists = WRP_FIELD_BIT(WRP_FIELD__HEADERS)
+                         | WRP_FIELD_BIT(WRP_FIELD__METADATA)
+                         | WRP_FIELD_BIT(WRP_FIELD__PARTNER_IDS);
+    wrp_msg_t *got = NULL;
+
+    test_wrp_from_msgpack_helper(from_msgpack_ex);
+
+    if (WRPE_OK != test.wrp_from_msgpack_rv) {
+        return;
+    }
+
+    /* Skipping the lists must not change anything else. */
+    CU_ASSERT_FATAL(WRPE_OK
+                    == wrp_from_msgpack_ex(test.msgpack, test.msgpack_len,
+                                           ~lists, &got));
+    switch (got->msg_type) {
+        case WRP_MSG_TYPE__REQ:
+            CU_ASSERT(0 == got->u.req.headers.count);
+            CU_ASSERT(0 == got->u.req.metadata.count);
+            CU_ASSERT(0 == got->u.req.partner_ids.count);
+            CU_ASSERT(0 == assert_wrp_string_eq(&test.in.u.req.trans_id,
+                                                &got->u.req.trans_id));
+            CU_ASSERT(test.in.u.req.payload.len == got->u.req.payload.len);
+            break;
+        case WRP_MSG_TYPE__EVENT:
+            CU_ASSERT(0 == got->u.event.headers.count);
+            CU_ASSERT(0 == got->u.event.metadata.count);
+            CU_ASSERT(0 == got->u.event.partner_ids.count);
+            CU_ASSERT(0 == assert_wrp_string_eq(&test.in.u.event.dest,
+                                                &got->u.event.dest));
+            CU_ASSERT(test.in.u.event.payload.len == got->u.event.payload.len);
+            break;
+        case WRP_MSG_TYPE__CREATE:
+        case WRP_MSG_TYPE__RETRIEVE:
+        case WRP_MSG_TYPE__UPDATE:
+        case WRP_MSG_TYPE__DELETE:
+            CU_ASSERT(0 == got->u.crud.headers.count);
+            CU_ASSERT(0 == got->u.crud.metadata.count);
+            CU_ASSERT(0 == got->u.crud.partner_ids.count);
+            CU_ASSERT(0 == assert_wrp_string_eq(&test.in.u.crud.path,
+                                                &got->u.crud.path));
+            break;
+        default:
+            break;
+    }
+    wrp_destroy(got);
+
+    /* The payload of a request is required, so the mask can't drop it. */
+    CU_ASSERT_FATAL(WRPE_OK
+                    == wrp_from_msgpack_ex(test.msgpack, test.msgpack_len,
+                                           ~WRP_FIELD_BIT(WRP_FIELD__PAYLOAD),
+                                           &got));
+    switch (got->msg_type) {
+        case WRP_MSG_TYPE__REQ:
+            CU_ASSERT(test.in.u.req.payload.len == got->u.req.payload.len);
+            CU_ASSERT(0 == assert_wrp_blob_eq(&test.in.u.req.payload,
+                                              &got->u.req.payload));
+            break;
+        case WRP_MSG_TYPE__EVENT:
+            CU_ASSERT(0 == got->u.event.payload.len);
+            CU_ASSERT(NULL == got->u.event.payload.data);
+            CU_ASSERT(0 == assert_wrp_string_eq(&test.in.u.event.dest,
+                                                &got->u.event.dest));
+            break;
+        default:
+            break;
+    }
+    wrp_destroy(got);
+}
+
+
+static void test_wrp_from_msgpack_batch()
+{
+    const void *srcs[7];
+    size_t lens[7];
+    wrp_msg_t **got = NULL;
+    WRPcode rv;
+
+    for (size_t i = 0; i < 7; i++) {
+        srcs[i] = test.msgpack;
+        lens[i] = test.msgpack_len;
+    }
+
+    /* More threads than messages, so some get nothing to do. */
+    for (size_t threads = 0; threads < 9; threads += 4) {
+        rv = wrp_from_msgpack_batch(srcs, lens, 7, threads, &got);
+        CU_ASSERT(test.wrp_from_msgpack_rv == rv);
+        CU_ASSERT_FATAL(NULL != got);
+
+        for (size_t i = 0; i < 7; i++) {
+            if (WRPE_OK == rv) {
+                CU_ASSERT(0 == assert_wrp_equals(&test.in, got[i]));
+                CU_ASSERT(WRPE_OK == wrp_destroy(got[i]));
+            } else {
+                CU_ASSERT(NULL == got[i]);
+            }
+        }
+        CU_ASSERT(WRPE_OK == wrp_destroy_batch(got));
+        got = NULL;
+    }
+}
+
+
+static void stream_cb(void *ctx, WRPcode rv, wrp_msg_t *msg)
+{
+    int *count = (int *) ctx;
+
+    CU_ASSERT(WRPE_OK == rv);
+    if (WRPE_OK == rv) {
+        CU_ASSERT(0 == assert_wrp_equals(&test.in, msg));
+    }
+    (*count)++;
+}
+
+
+static void test_wrp_stream()
+{
+    wrp_stream_t *s = NULL;
+    uint8_t *buf    = NULL;
+    size_t len      = 3 * test.msgpack_len;
+    int count       = 0;
+
+    if (WRPE_OK != test.wrp_from_msgpack_rv) {
+        return;
+    }
+
+    buf = malloc(len);
+    CU_ASSERT_FATAL(NULL != buf);
+    for (size_t i = 0; i < 3; i++) {
+        memcpy(&buf[i * test.msgpack_len], test.msgpack, test.msgpack_len);
+    }
+
+    CU_ASSERT_FATAL(WRPE_OK == wrp_stream_create(&s, test.msgpack_len, stream_cb,
+                                                 &count));
+
+    /* All at once, then one byte at a time, then in uneven pieces. */
+    CU_ASSERT(WRPE_OK == wrp_stream_feed(s, buf, len));
+    CU_ASSERT(3 == count);
+
+    for (size_t i = 0; i < len; i++) {
+        CU_ASSERT(WRPE_OK == wrp_stream_feed(s, &buf[i], 1));
+    }
+    CU_ASSERT(6 == count);
+
+    for (size_t i = 0; i < len; i += 7) {
+        size_t n = ((len - i) < 7) ? (len - i) : 7;
+
+        CU_ASSERT(WRPE_OK == wrp_stream_feed(s, &buf[i], n));
+    }
+    CU_ASSERT(9 == count);
+    wrp_stream_destroy(s);
+
+    /* A message larger than allowed is rejected. */
+    CU_ASSERT_FATAL(WRPE_OK == wrp_stream_create(&s, test.msgpack_len - 1,
+                                                 stream_cb, &count));
+    CU_ASSERT(WRPE_MSG_TOO_BIG == wrp_stream_feed(s, buf, len));
+    CU_ASSERT(WRPE_OK == wrp_stream_feed(s, buf, 1));
+    CU_ASSERT(WRPE_MSG_TOO_BIG == wrp_stream_feed(s, &buf[1], len - 1));
+    CU_ASSERT(9 == count);
+    wrp_stream_destroy(s);
+
+    free(buf);
+}
+
+
+static void test_wrp_msg_compact_clone()
+{
+    wrp_msg_t *msg   = NULL;
+    wrp_msg_t *clone = NULL;
+    wrp_msg_t bad;
+
+    CU_ASSERT(WRPE_INVALID_ARGS == wrp_msg_compact_clone(NULL, &clone));
+    CU_ASSERT(WRPE_INVALID_ARGS == wrp_msg_compact_clone(&test.in, NULL));
+
+    /* An unknown message type is rejected rather than cloned. */
+    bad          = test.in;
+    bad.msg_type = (enum wrp_msg_type) 99;
+    CU_ASSERT(WRPE_NOT_A_WRP_MSG == wrp_msg_compact_clone(&bad, &clone));
+    CU_ASSERT(NULL == clone);
+
+    if (WRPE_OK != test.wrp_from_msgpack_rv) {
+        return;
+    }
+
+    /* A message built by hand can be cloned too. */
+    CU_ASSERT_FATAL(WRPE_OK == wrp_msg_compact_clone(&test.in, &clone));
+    CU_ASSERT(0 == assert_wrp_equals(&test.in, clone));
+    CU_ASSERT(WRPE_OK == wrp_destroy(clone));
+
+    CU_ASSERT_FATAL(WRPE_OK == wrp_from_msgpack(test.msgpack, test.msgpack_len,
+                                                &msg));
+    CU_ASSERT_FATAL(WRPE_OK == wrp_msg_compact_clone(msg, &clone));
+    CU_ASSERT(WRPE_OK == wrp_destroy(msg));
+
+    CU_ASSERT(0 == assert_wrp_equals(&test.in, clone));
+    CU_ASSERT(WRPE_OK == wrp_destroy(clone));
+}
+
+
+static const struct wrp_nvp_list *get_metadata(const wrp_msg_t *msg)
+{
+    switch (msg->msg_type) {
+        case WRP_MSG_TYPE__REQ:
+            return &msg->u.req.metadata;
+        case WRP_MSG_TYPE__EVENT:
+            return &msg->u.event.metadata;
+        case WRP_MSG_TYPE__CREATE:
+        case WRP_MSG_TYPE__RETRIEVE:
+        case WRP_MSG_TYPE__UPDATE:
+        case WRP_MSG_TYPE__DELETE:
+            return &msg->u.crud.metadata;
+        default:
+            break;
+    }
+
+    return NULL;
+}
+
+
+static void test_wrp_metadata_get()
+{
+    const struct wrp_nvp_list *exp;
+    wrp_msg_t *got[2] = { NULL, NULL };
+
+    CU_ASSERT(NULL == wrp_metadata_get(NULL, "a", 1));
+
+    if (WRPE_OK != test.wrp_from_msgpack_rv) {
+        return;
+    }
+
+    CU_ASSERT_FATAL(WRPE_OK == wrp_from_msgpack(test.msgpack, test.msgpack_len,
+                                                &got[0]));
+    CU_ASSERT_FATAL(WRPE_OK
+                    == wrp_from_msgpack_ex(test.msgpack, test.msgpack_len,
+                                           WRP_FIELDS_ALL | WRP_INDEX_METADATA,
+                                           &got[1]));
+
+    /* The same answers with and without the index. */
+    exp = get_metadata(&test.in);
+    for (size_t i = 0; i < 2; i++) {
+        CU_ASSERT(NULL == wrp_metadata_get(got[i], "no such key", 11));
+
+        for (size_t j = 0; exp && (j < exp->count); j++) {
+            const struct wrp_string *v;
+            size_t first = j;
+
+            /* Duplicate names find the first entry. */
+            for (size_t k = 0; k < j; k++) {
+                if ((exp->list[k].name.len == exp->list[j].name.len)
+                    && (0 == memcmp(exp->list[k].name.s, exp->list[j].name.s,
+                                    exp->list[j].name.len)))
+                {
+                    first = k;
+                    break;
+                }
+            }
+
+            v = wrp_metadata_get(got[i], exp->list[j].name.s,
+                                 exp->list[j].name.len);
+            CU_ASSERT_FATAL(NULL != v);
+            CU_ASSERT(0 == assert_wrp_string_eq(&exp->list[first].value, v));
+        }
+
+        /* A copy or an edited list is scanned, not found with the old index. */
+        if (exp && exp->count) {
+            struct wrp_nvp nvp = { { 0, NULL }, { 1, "x" } };
+            wrp_msg_t copy     = *got[i];
+            struct wrp_nvp_list *l;
+
+            l        = (struct wrp_nvp_list *) get_metadata(&copy);
+            l->count = 0;
+            CU_ASSERT(NULL == wrp_metadata_get(&copy, exp->list[0].name.s,
+                                               exp->list[0].name.len));
+
+            nvp.name = exp->list[0].name;
+            l->list  = &nvp;
+            l->count = 1;
+            CU_ASSERT(nvp.value.s == wrp_metadata_get(&copy, nvp.name.s,
+                                                      nvp.name.len)->s);
+
+            l        = (struct wrp_nvp_list *) get_metadata(got[i]);
+            l->count = 0;
+            CU_ASSERT(NULL == wrp_metadata_get(got[i], exp->list[0].name.s,
+                                               exp->list[0].name.len));
+        }
+        wrp_destroy(got[i]);
+    }
+}
+
+
+static const struct wrp_string_list *get_headers(const wrp_msg_t *msg)
+{
+    switch (msg->msg_type) {
+        case WRP_MSG_TYPE__REQ:
+            return &msg->u.req.headers;
+        case WRP_MSG_TYPE__EVENT:
+            return &msg->u.event.headers;
+        case WRP_MSG_TYPE__CREATE:
+        case WRP_MSG_TYPE__RETRIEVE:
+        case WRP_MSG_TYPE__UPDATE:
+        case WRP_MSG_TYPE__DELETE:
+            return &msg->u.crud.headers;
+        default:
+            break;
+    }
+
+    return NULL;
+}
+
+
+static void test_wrp_header_get()
+{
+    const struct wrp_string_list *exp;
+    wrp_msg_t *got[2] = { NULL, NULL };
+    struct wrp_string value;
+
+    CU_ASSERT(false == wrp_header_get(NULL, "a", 1, &value));
+
+    if (WRPE_OK != test.wrp_from_msgpack_rv) {
+        return;
+    }
+
+    CU_ASSERT_FATAL(WRPE_OK == wrp_from_msgpack(test.msgpack, test.msgpack_len,
+                                                &got[0]));
+    CU_ASSERT_FATAL(WRPE_OK
+                    == wrp_from_msgpack_ex(test.msgpack, test.msgpack_len,
+                                           WRP_FIELDS_ALL | WRP_INDEX_HEADERS,
+                                           &got[1]));
+
+    /* The same answers with and without the index. */
+    exp = get_headers(&test.in);
+    for (size_t i = 0; i < 2; i++) {
+        CU_ASSERT(false == wrp_header_get(got[i], "no-such-header", 14, &value));
+
+        for (size_t j = 0; exp && (j < exp->count); j++) {
+            const char *colon = memchr(exp->list[j].s, ':', exp->list[j].len);
+            const char *end   = &exp->list[j].s[exp->list[j].len];
+            char name[64];
+            size_t len;
+
+            if (!colon) {
+                continue;
+            }
+
+            /* The name is matched without case. */
+            len = (size_t) (colon - exp->list[j].s);
+            CU_ASSERT_FATAL(len < sizeof(name));
+            for (size_t k = 0; k < len; k++) {
+                name[k] = (char) toupper((unsigned char) exp->list[j].s[k]);
+            }
+
+            colon++;
+            while ((colon < end) && (' ' == *colon)) {
+                colon++;
+            }
+
+            CU_ASSERT_FATAL(true == wrp_header_get(got[i], name, len, &value));
+            CU_ASSERT((size_t) (end - colon) == value.len);
+            CU_ASSERT(0 == memcmp(colon, value.s, value.len));
+        }
+
+        /* A copy or an edited list is scanned, not found with the old index. */
+        if (exp && exp->count) {
+            struct wrp_string only = { 11, "X-New: only" };
+            wrp_msg_t copy         = *got[i];
+            struct wrp_string_list *l;
+
+            l        = (struct wrp_string_list *) get_headers(&copy);
+            l->list  = &only;
+            l->count = 1;
+            CU_ASSERT(true == wrp_header_get(&copy, "x-new", 5, &value));
+
+            l        = (struct wrp_string_list *) get_headers(got[i]);
+            l->list  = &only;
+            l->count = 1;
+            CU_ASSERT(true == wrp_header_get(got[i], "x-new", 5, &value));
+            CU_ASSERT(4 == value.len);
+
+            l->count = 0;
+            CU_ASSERT(false == wrp_header_get(got[i], "x-new", 5, &value));
+        }
+        wrp_destroy(got[i]);
+    }
+}
+
+
+static void test_wrp_decoder()
+{
+    CU_ASSERT_FATAL(WRPE_OK == wrp_decoder_create(&decoder));
+
+    /* The second pass reuses the buffers from the first. */
+    test_wrp_from_msgpack_helper(from_msgpack_decoder);
+    test_wrp_from_msgpack_helper(from_msgpack_decoder);
+
+    wrp_decoder_reset(decoder);
+    test_wrp_from_msgpack_helper(from_msgpack_decoder);
+
+    wrp_decoder_destroy(decoder);
+    decoder = NULL;
+}
+
+
+static void test_wrp_peek()
+{
+    struct wrp_string none            = { .len = 0, .s = NULL };
+    const struct wrp_string *source   = &none;
+    const struct wrp_string *dest     = &none;
+    const struct wrp_string *trans_id = &none;
+    uint8_t *deep;
+    size_t len;
+    wrp_peek_t got;
+
+    /* A message that doesn't decode may still have valid routing fields. */
+    if (WRPE_OK != test.wrp_from_msgpack_rv) {
+        return;
+    }
+
+    CU_ASSERT_FATAL(WRPE_OK == wrp_peek(test.msgpack, test.msgpack_len, &got));
+    CU_ASSERT(test.in.msg_type == got.msg_type);
+
+    switch (test.in.msg_type) {
+        case WRP_MSG_TYPE__REQ:
+            source   = &test.in.u.req.source;
+            dest     = &test.in.u.req.dest;
+            trans_id = &test.in.u.req.trans_id;
+            break;
+        case WRP_MSG_TYPE__EVENT:
+            source = &test.in.u.event.source;
+            dest   = &test.in.u.event.dest;
+            break;
+        case WRP_MSG_TYPE__CREATE:
+        case WRP_MSG_TYPE__RETRIEVE:
+        case WRP_MSG_TYPE__UPDATE:
+        case WRP_MSG_TYPE__DELETE:
+            source   = &test.in.u.crud.source;
+            dest     = &test.in.u.crud.dest;
+            trans_id = &test.in.u.crud.trans_id;
+            break;
+        default:
+            break;
+    }
+
+    CU_ASSERT(0 == assert_wrp_string_eq(source, &got.source));
+    CU_ASSERT(0 == assert_wrp_string_eq(dest, &got.dest));
+    CU_ASSERT(0 == assert_wrp_string_eq(trans_id, &got.trans_id));
+
+    /* Skipping an unknown key's value doesn't recurse. */
+    deep = deep_event(1000000, &len);
+    CU_ASSERT_FATAL(WRPE_OK == wrp_peek(deep, len, &got));
+    CU_ASSERT(WRP_MSG_TYPE__EVENT == got.msg_type);
+    CU_ASSERT(1 == got.source.len);
+    CU_ASSERT('s' == got.source.s[0]);
+    free(deep);
+}
+
+
 static void test_wrp_to_msgpack()
 {
     uint8_t *got = NULL;
@@ -469,6 +1032,202 @@ static void test_wrp_to_msgpack()
 }
 
 
+static void test_wrp_to_msgpack_iov()
+{
+    struct iovec iov[WRP_IOV_MAX];
+    uint8_t *got = NULL;
+    size_t len   = 0;
+    int count    = 0;
+    size_t at    = 0;
+    uint8_t buf[1024];
+    WRPcode rv;
+
+    rv = wrp_to_msgpack_iov(&test.in, &got, &len, iov, &count);
+    CU_ASSERT_FATAL(test.wrp_to_msgpack_rv == rv);
+
+    if (WRPE_OK == rv) {
+        CU_ASSERT_FATAL((0 < count) && (count <= WRP_IOV_MAX));
+
+        /* Together the iovecs must be exactly the normal encoding. */
+        for (int i = 0; i < count; i++) {
+            CU_ASSERT_FATAL(at + iov[i].iov_len <= sizeof(buf));
+            memcpy(&buf[at], iov[i].iov_base, iov[i].iov_len);
+            at += iov[i].iov_len;
+        }
+        CU_ASSERT(at == wrp_msgpack_size(&test.in));
+        CU_ASSERT(0 == memcmp(buf, test.asymetric_active ? test.asymetric_msgpack
+                                                         : test.msgpack, at));
+    }
+
+    free(got);
+}
+
+
+struct chunks {
+    uint8_t buf[1024];
+    size_t len;
+    size_t calls;
+};
+
+
+static WRPcode collect(void *ctx, const void *data, size_t len)
+{
+    struct chunks *c = (struct chunks *) ctx;
+
+    CU_ASSERT_FATAL(c->len + len <= sizeof(c->buf));
+    memcpy(&c->buf[c->len], data, len);
+    c->len += len;
+    c->calls++;
+
+    return WRPE_OK;
+}
+
+
+static void test_wrp_to_msgpack_flush()
+{
+    struct chunks c;
+    uint8_t stage[32];
+    WRPcode rv;
+
+    memset(&c, 0, sizeof(c));
+
+    rv = wrp_to_msgpack_flush(&test.in, stage, sizeof(stage), collect, &c);
+    CU_ASSERT_FATAL(test.wrp_to_msgpack_rv == rv);
+
+    if (WRPE_OK == rv) {
+        CU_ASSERT(c.len == wrp_msgpack_size(&test.in));
+        CU_ASSERT(0 == memcmp(c.buf,
+                              test.asymetric_active ? test.asymetric_msgpack
+                                                    : test.msgpack,
+                              c.len));
+    }
+}
+
+
+static void test_wrp_to_msgpack_batch()
+{
+    const wrp_msg_t *msgs[2] = { &test.in, &test.in };
+    const char *goal;
+    uint8_t *got = NULL;
+    size_t size;
+    size_t len;
+
+    if (WRPE_OK != test.wrp_to_msgpack_rv) {
+        return;
+    }
+
+    goal = test.asymetric_active ? test.asymetric_msgpack : test.msgpack;
+    size = wrp_msgpack_size(&test.in);
+
+    CU_ASSERT_FATAL(WRPE_OK == wrp_to_msgpack_batch(msgs, 2, WRP_FRAMING__NONE,
+                                                    &got, &len));
+    CU_ASSERT_FATAL(2 * size == len);
+    CU_ASSERT(0 == memcmp(got, goal, size));
+    CU_ASSERT(0 == memcmp(&got[size], goal, size));
+
+    /* Reuse the buffer, which is large enough for the framing. */
+    len = size;
+    CU_ASSERT(WRPE_MSG_TOO_BIG
+              == wrp_to_msgpack_batch(msgs, 2, WRP_FRAMING__LEN32, &got, &len));
+    free(got);
+
+    got = NULL;
+    CU_ASSERT_FATAL(WRPE_OK == wrp_to_msgpack_batch(msgs, 2, WRP_FRAMING__LEN32,
+                                                    &got, &len));
+    CU_ASSERT_FATAL(2 * (4 + size) == len);
+    for (size_t i = 0; i < 2; i++) {
+        const uint8_t *frame = &got[i * (4 + size)];
+        size_t framed        = ((size_t) frame[0] << 24)
+                             | ((size_t) frame[1] << 16)
+                             | ((size_t) frame[2] << 8)
+                             | (size_t) frame[3];
+
+        CU_ASSERT(size == framed);
+        CU_ASSERT(0 == memcmp(&frame[4], goal, size));
+    }
+    free(got);
+}
+
+
+static void test_wrp_rewrite_field()
+{
+    const char *dest = "event:rewritten/to/something/longer/than/a/fixstr";
+    wrp_msg_t msg    = test.in;
+    struct wrp_string *field;
+    uint8_t *want = NULL;
+    uint8_t *got  = NULL;
+    size_t want_len;
+    size_t got_len;
+
+    if ((WRPE_OK != test.wrp_to_msgpack_rv) || test.asymetric_active) {
+        return;
+    }
+
+    switch (msg.msg_type) {
+        case WRP_MSG_TYPE__REQ:
+            field = &msg.u.req.dest;
+            break;
+        case WRP_MSG_TYPE__EVENT:
+            field = &msg.u.event.dest;
+            break;
+        case WRP_MSG_TYPE__CREATE:
+        case WRP_MSG_TYPE__RETRIEVE:
+        case WRP_MSG_TYPE__UPDATE:
+        case WRP_MSG_TYPE__DELETE:
+            field = &msg.u.crud.dest;
+            break;
+        default:
+            CU_ASSERT(WRPE_NOT_A_WRP_MSG
+                      == wrp_rewrite_field(test.msgpack, test.msgpack_len,
+                                           WRP_FIELD__DEST, dest, strlen(dest),
+                                           &got, &got_len));
+            return;
+    }
+
+    field->s   = dest;
+    field->len = strlen(dest);
+    CU_ASSERT_FATAL(WRPE_OK == wrp_to_msgpack(&msg, &want, &want_len));
+
+    CU_ASSERT_FATAL(WRPE_OK
+                    == wrp_rewrite_field(test.msgpack, test.msgpack_len,
+                                         WRP_FIELD__DEST, dest, strlen(dest),
+                                         &got, &got_len));
+    CU_ASSERT_FATAL(want_len == got_len);
+    CU_ASSERT(0 == memcmp(want, got, got_len));
+
+    free(got);
+    free(want);
+}
+
+
+static void test_wrp_template()
+{
+    wrp_template_t *tmpl = NULL;
+    uint8_t *got         = NULL;
+    size_t len           = 0;
+    uint32_t vary;
+    WRPcode rv;
+
+    if (WRPE_OK != test.wrp_to_msgpack_rv) {
+        return;
+    }
+
+    vary = WRP_FIELD_BIT(WRP_FIELD__DEST) | WRP_FIELD_BIT(WRP_FIELD__MSG_ID)
+         | WRP_FIELD_BIT(WRP_FIELD__PAYLOAD) | WRP_FIELD_BIT(WRP_FIELD__STATUS);
+
+    CU_ASSERT_FATAL(WRPE_OK == wrp_template_create(&tmpl, &test.in, vary));
+
+    rv = wrp_template_encode(tmpl, &test.in, &got, &len);
+    CU_ASSERT_FATAL(WRPE_OK == rv);
+    CU_ASSERT(len == wrp_msgpack_size(&test.in));
+    CU_ASSERT(0 == memcmp(got, test.asymetric_active ? test.asymetric_msgpack
+                                                     : test.msgpack, len));
+
+    free(got);
+    wrp_template_destroy(tmpl);
+}
+
+
 static void test_wrp_to_string()
 {
     char *got  = NULL;
@@ -514,12 +1273,120 @@ static void test_wrp_to_string()
 }
 
 
+static void test_wrp_to_string_buf()
+{
+    char buf[4096];
+    size_t len = 0;
+    size_t exp_len;
+
+    if (NULL == test.string) {
+        return;
+    }
+    exp_len = strlen(test.string);
+
+    /* Just the size. */
+    CU_ASSERT(WRPE_MSG_TOO_BIG == wrp_to_string_buf(&test.in, NULL, 0, &len));
+    CU_ASSERT(exp_len == len);
+
+    CU_ASSERT_FATAL(exp_len < sizeof(buf));
+    CU_ASSERT(WRPE_OK == wrp_to_string_buf(&test.in, buf, exp_len + 1, &len));
+    CU_ASSERT(exp_len == len);
+    CU_ASSERT(0 == strcmp(test.string, buf));
+
+    /* Cut short, but still terminated. */
+    CU_ASSERT(WRPE_MSG_TOO_BIG == wrp_to_string_buf(&test.in, buf, 10, &len));
+    CU_ASSERT(exp_len == len);
+    CU_ASSERT(9 == strlen(buf));
+    CU_ASSERT(0 == memcmp(test.string, buf, 9));
+}
+
+
+static void test_wrp_to_json()
+{
+    struct chunks c;
+    uint8_t stage[32];
+    char buf[1024];
+    size_t len = 0;
+    WRPcode rv;
+
+    rv = wrp_to_json(&test.in, WRP_JSON_PAYLOAD__BASE64, NULL, 0, &len);
+    if (WRPE_NOT_A_WRP_MSG == rv) {
+        return;
+    }
+    CU_ASSERT(WRPE_MSG_TOO_BIG == rv);
+    CU_ASSERT_FATAL(len < sizeof(buf));
+
+    CU_ASSERT(WRPE_OK == wrp_to_json(&test.in, WRP_JSON_PAYLOAD__BASE64, buf,
+                                     len + 1, NULL));
+    CU_ASSERT(len == strlen(buf));
+    CU_ASSERT('{' == buf[0]);
+    CU_ASSERT('}' == buf[len - 1]);
+
+    /* Staged through a small buffer it is the same. */
+    memset(&c, 0, sizeof(c));
+    CU_ASSERT(WRPE_OK
+              == wrp_to_json_flush(&test.in, WRP_JSON_PAYLOAD__BASE64, stage,
+                                   sizeof(stage), collect, &c));
+    CU_ASSERT(len == c.len);
+    CU_ASSERT(0 == memcmp(buf, c.buf, len));
+}
+
+
+static void test_wrp_from_json()
+{
+    wrp_msg_t *msg = NULL;
+    uint8_t *a     = NULL;
+    uint8_t *b     = NULL;
+    char buf[1024];
+    size_t a_len;
+    size_t b_len;
+    size_t len;
+
+    if ((WRPE_OK != test.wrp_to_msgpack_rv)
+        || (WRPE_OK != wrp_to_json(&test.in, WRP_JSON_PAYLOAD__BASE64, buf,
+                                   sizeof(buf), &len)))
+    {
+        return;
+    }
+
+    /* The round trip gives back the same message. */
+    CU_ASSERT_FATAL(WRPE_OK == wrp_from_json(buf, len, WRP_JSON_PAYLOAD__BASE64,
+                                             &msg));
+    CU_ASSERT_FATAL(WRPE_OK == wrp_to_msgpack(&test.in, &a, &a_len));
+    CU_ASSERT_FATAL(WRPE_OK == wrp_to_msgpack(msg, &b, &b_len));
+    CU_ASSERT(a_len == b_len);
+    CU_ASSERT(0 == memcmp(a, b, a_len));
+
+    CU_ASSERT(WRPE_OK == wrp_destroy(msg));
+    free(a);
+    free(b);
+}
+
+
 static void add_suites(CU_pSuite *suite)
 {
     *suite = CU_add_suite(test_name, NULL, NULL);
     CU_add_test(*suite, "Test wrp_from_msgpack()", test_wrp_from_msgpack);
+    CU_add_test(*suite, "Test wrp_from_msgpack_reader()", test_wrp_from_msgpack_reader);
+    CU_add_test(*suite, "Test wrp_from_msgpack_arena()", test_wrp_from_msgpack_arena);
+    CU_add_test(*suite, "Test wrp_from_msgpack_ex()", test_wrp_from_msgpack_ex);
+    CU_add_test(*suite, "Test wrp_from_msgpack_batch()", test_wrp_from_msgpack_batch);
+    CU_add_test(*suite, "Test wrp_msg_compact_clone()", test_wrp_msg_compact_clone);
+    CU_add_test(*suite, "Test wrp_metadata_get()", test_wrp_metadata_get);
+    CU_add_test(*suite, "Test wrp_header_get()", test_wrp_header_get);
+    CU_add_test(*suite, "Test wrp_decoder_decode()", test_wrp_decoder);
+    CU_add_test(*suite, "Test wrp_stream_feed()", test_wrp_stream);
+    CU_add_test(*suite, "Test wrp_peek()", test_wrp_peek);
     CU_add_test(*suite, "Test wrp_to_msgpack()  ", test_wrp_to_msgpack);
+    CU_add_test(*suite, "Test wrp_to_msgpack_iov()", test_wrp_to_msgpack_iov);
+    CU_add_test(*suite, "Test wrp_to_msgpack_flush()", test_wrp_to_msgpack_flush);
+    CU_add_test(*suite, "Test wrp_to_msgpack_batch()", test_wrp_to_msgpack_batch);
+    CU_add_test(*suite, "Test wrp_template_encode()", test_wrp_template);
+    CU_add_test(*suite, "Test wrp_rewrite_field()", test_wrp_rewrite_field);
     CU_add_test(*suite, "Test wrp_to_string()  ", test_wrp_to_string);
+    CU_add_test(*suite, "Test wrp_to_string_buf()", test_wrp_to_string_buf);
+    CU_add_test(*suite, "Test wrp_to_json()", test_wrp_to_json);
+    CU_add_test(*suite, "Test wrp_from_json()", test_wrp_from_json);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -0,0 +1,26 @@
+/* SPDX-FileCopyrightText: 2022 Comcast Cable Communications Management, LLC */
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include "test_common.h"
+
+/* Test that a duplicated key is rejected instead of silently picking one. */
+
+// clang-format off
+const struct test_vector test = {
+    .wrp_from_msgpack_rv = WRPE_NOT_A_WRP_MSG,
+    .wrp_to_msgpack_rv   = WRPE_NOT_A_WRP_MSG,
+    .wrp_to_string_rv    = WRPE_NOT_A_WRP_MSG,
+
+    .in.msg_type = 0,
+
+    .msgpack_len = 64,
+    .msgpack =
+        "\x84"  /* 4 name value pairs */
+            "\xa8""msg_type"         /* : */ "\x04" // 4
+            "\xa4""dest"             /* : */ "\xac""dest-address"
+            "\xa6""source"           /* : */ "\xae""source-address"
+            "\xa4""dest"             /* : */ "\xa7""dest-02"
+};
+// clang-format on
+
+const char *test_name = __FILE__;
@@ -53,12 +53,673 @@ void test_03(void)
     CU_ASSERT(WRPE_INVALID_ARGS == wrp_to_msgpack(NULL, &buf, &len));
 }
 
+struct collected {
+    uint8_t *buf;
+    size_t len;
+};
+
+static WRPcode collect(void *ctx, const void *data, size_t len)
+{
+    struct collected *c = (struct collected *) ctx;
+
+    c->buf = realloc(c->buf, c->len + len);
+    memcpy(&c->buf[c->len], data, len);
+    c->len += len;
+
+    return WRPE_OK;
+}
+
+void test_04(void)
+{
+    wrp_msg_t msg;
+    uint8_t *buf = NULL;
+    size_t len   = 0;
+    char big[70000];
+    int status = -70000;
+    int rdr    = 300;
+    struct wrp_string partners[20];
+    struct collected c = { NULL, 0 };
+    uint8_t stage[64];
+
+    CU_ASSERT(0 == wrp_msgpack_size(NULL));
+
+    memset(&msg, 0, sizeof(wrp_msg_t));
+    msg.msg_type = (enum wrp_msg_type) 99;
+    CU_ASSERT(0 == wrp_msgpack_size(&msg));
+    CU_ASSERT(WRPE_NOT_A_WRP_MSG == wrp_to_msgpack(&msg, &buf, &len));
+    CU_ASSERT(NULL == buf);
+
+    /* Push every header past its smallest form. */
+    memset(big, 'x', sizeof(big));
+    msg.msg_type           = WRP_MSG_TYPE__REQ;
+    msg.u.req.dest.s       = big;
+    msg.u.req.dest.len     = 40;
+    msg.u.req.source.s     = big;
+    msg.u.req.source.len   = 300;
+    msg.u.req.trans_id.s   = big;
+    msg.u.req.trans_id.len = sizeof(big);
+    msg.u.req.payload.data = (const uint8_t *) big;
+    msg.u.req.payload.len  = 3000;
+    msg.u.req.status.num   = &status;
+    msg.u.req.rdr.num      = &rdr;
+
+    for (size_t i = 0; i < 20; i++) {
+        partners[i].s   = big;
+        partners[i].len = i;
+    }
+    msg.u.req.partner_ids.list  = partners;
+    msg.u.req.partner_ids.count = 20;
+
+    CU_ASSERT_FATAL(WRPE_OK == wrp_to_msgpack(&msg, &buf, &len));
+    CU_ASSERT(len == wrp_msgpack_size(&msg));
+
+    /* The direct writer must match what mpack writes. */
+    CU_ASSERT_FATAL(WRPE_OK == wrp_to_msgpack_flush(&msg, stage, sizeof(stage),
+                                                    collect, &c));
+    CU_ASSERT_FATAL(len == c.len);
+    CU_ASSERT(0 == memcmp(buf, c.buf, len));
+
+    free(c.buf);
+    free(buf);
+
+    buf = stage;
+    len = sizeof(stage);
+    CU_ASSERT(WRPE_MSG_TOO_BIG == wrp_to_msgpack(&msg, &buf, &len));
+}
+
+static WRPcode refuse(void *ctx, const void *data, size_t len)
+{
+    (void) data;
+    (void) len;
+
+    (*(int *) ctx)++;
+
+    return WRPE_NO_SCHEME;
+}
+
+void test_05(void)
+{
+    uint8_t stage[32];
+    size_t size = sizeof(stage);
+    char payload[100];
+    int calls = 0;
+    wrp_msg_t msg;
+
+    memset(&msg, 0, sizeof(wrp_msg_t));
+    msg.msg_type = WRP_MSG_TYPE__SVC_ALIVE;
+
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_to_msgpack_flush(NULL, stage, size, refuse, &calls));
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_to_msgpack_flush(&msg, NULL, size, refuse, &calls));
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_to_msgpack_flush(&msg, stage, 31, refuse, &calls));
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_to_msgpack_flush(&msg, stage, size, NULL, &calls));
+
+    /* The callback's error stops the encoding and is returned. */
+    memset(payload, 'p', sizeof(payload));
+    msg.msg_type             = WRP_MSG_TYPE__EVENT;
+    msg.u.event.dest.s       = "event:x";
+    msg.u.event.dest.len     = 7;
+    msg.u.event.source.s     = "mac:112233445566";
+    msg.u.event.source.len   = 16;
+    msg.u.event.payload.data = (const uint8_t *) payload;
+    msg.u.event.payload.len  = sizeof(payload);
+    msg.u.event.msg_id.s     = "id";
+    msg.u.event.msg_id.len   = 2;
+
+    CU_ASSERT(WRPE_NO_SCHEME
+              == wrp_to_msgpack_flush(&msg, stage, size, refuse, &calls));
+    CU_ASSERT(1 == calls);
+}
+
+void test_06(void)
+{
+    wrp_template_t *tmpl = NULL;
+    struct wrp_string partners[2];
+    wrp_msg_t proto;
+    wrp_msg_t msg;
+    uint8_t *got  = NULL;
+    uint8_t *want = NULL;
+    size_t got_len;
+    size_t want_len;
+    uint32_t vary;
+
+    vary = WRP_FIELD_BIT(WRP_FIELD__DEST) | WRP_FIELD_BIT(WRP_FIELD__MSG_ID)
+         | WRP_FIELD_BIT(WRP_FIELD__PAYLOAD);
+
+    partners[0].s   = "comcast";
+    partners[0].len = 7;
+    partners[1].s   = "example";
+    partners[1].len = 7;
+
+    memset(&proto, 0, sizeof(wrp_msg_t));
+    proto.msg_type                  = WRP_MSG_TYPE__EVENT;
+    proto.u.event.dest.s            = "event:ignored";
+    proto.u.event.dest.len          = 13;
+    proto.u.event.source.s          = "mac:112233445566";
+    proto.u.event.source.len        = 16;
+    proto.u.event.content_type.s    = "application/json";
+    proto.u.event.content_type.len  = 16;
+    proto.u.event.partner_ids.list  = partners;
+    proto.u.event.partner_ids.count = 2;
+    proto.u.event.session_id.s      = "session";
+    proto.u.event.session_id.len    = 7;
+
+    CU_ASSERT(WRPE_INVALID_ARGS == wrp_template_create(NULL, &proto, vary));
+    CU_ASSERT(WRPE_INVALID_ARGS == wrp_template_create(&tmpl, &proto, 0));
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_template_create(&tmpl, &proto,
+                                     WRP_FIELD_BIT(WRP_FIELD__MSG_TYPE)));
+    CU_ASSERT_FATAL(WRPE_OK == wrp_template_create(&tmpl, &proto, vary));
+
+    /* Only the varying fields are set. */
+    memset(&msg, 0, sizeof(wrp_msg_t));
+    msg.msg_type             = WRP_MSG_TYPE__EVENT;
+    msg.u.event.dest.s       = "event:device-status/online";
+    msg.u.event.dest.len     = 26;
+    msg.u.event.msg_id.s     = "1234";
+    msg.u.event.msg_id.len   = 4;
+    msg.u.event.payload.data = (const uint8_t *) "{}";
+    msg.u.event.payload.len  = 2;
+
+    CU_ASSERT_FATAL(WRPE_OK == wrp_template_encode(tmpl, &msg, &got, &got_len));
+
+    proto.u.event.dest              = msg.u.event.dest;
+    proto.u.event.msg_id            = msg.u.event.msg_id;
+    proto.u.event.payload           = msg.u.event.payload;
+    CU_ASSERT_FATAL(WRPE_OK == wrp_to_msgpack(&proto, &want, &want_len));
+
+    CU_ASSERT_FATAL(want_len == got_len);
+    CU_ASSERT(0 == memcmp(want, got, got_len));
+    free(got);
+
+    /* A varying field that is left out is left out of the encoding too. */
+    msg.u.event.payload.len = 0;
+    got                     = NULL;
+    CU_ASSERT_FATAL(WRPE_OK == wrp_template_encode(tmpl, &msg, &got, &got_len));
+    CU_ASSERT(got_len == want_len - 2 - 2 - 8);
+    free(got);
+
+    msg.msg_type = WRP_MSG_TYPE__REQ;
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_template_encode(tmpl, &msg, &got, &got_len));
+
+    free(want);
+    wrp_template_destroy(tmpl);
+}
+
+void test_07(void)
+{
+    const wrp_msg_t *msgs[2];
+    wrp_msg_t alive;
+    wrp_msg_t bad;
+    uint8_t *buf = NULL;
+    size_t len   = 0;
+
+    memset(&alive, 0, sizeof(wrp_msg_t));
+    alive.msg_type = WRP_MSG_TYPE__SVC_ALIVE;
+    memset(&bad, 0, sizeof(wrp_msg_t));
+    bad.msg_type = (enum wrp_msg_type) 99;
+
+    msgs[0] = &alive;
+    msgs[1] = NULL;
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_to_msgpack_batch(NULL, 1, WRP_FRAMING__NONE, &buf, &len));
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_to_msgpack_batch(msgs, 1, WRP_FRAMING__NONE, NULL, &len));
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_to_msgpack_batch(msgs, 1, (enum wrp_framing) 7,
+                                      &buf, &len));
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_to_msgpack_batch(msgs, 2, WRP_FRAMING__NONE, &buf, &len));
+
+    msgs[1] = &bad;
+    CU_ASSERT(WRPE_NOT_A_WRP_MSG
+              == wrp_to_msgpack_batch(msgs, 2, WRP_FRAMING__NONE, &buf, &len));
+    CU_ASSERT(NULL == buf);
+
+    /* An empty batch is valid. */
+    CU_ASSERT_FATAL(WRPE_OK == wrp_to_msgpack_batch(NULL, 0, WRP_FRAMING__LEN32,
+                                                    &buf, &len));
+    CU_ASSERT(0 == len);
+    free(buf);
+}
+
+void test_08(void)
+{
+    const char *dests[] = { "event:same", "event:else", "e:short",
+                            "event:something/longer/than/a/fixstr/header" };
+    uint8_t not_a_map[] = { 0x91, 0xc0 };
+    wrp_msg_t *got      = NULL;
+    uint8_t *out        = NULL;
+    uint8_t buf[256];
+    size_t out_len;
+    size_t len;
+    wrp_msg_t msg;
+
+    memset(&msg, 0, sizeof(wrp_msg_t));
+    msg.msg_type             = WRP_MSG_TYPE__EVENT;
+    msg.u.event.dest.s       = dests[0];
+    msg.u.event.dest.len     = strlen(dests[0]);
+    msg.u.event.source.s     = "mac:112233445566";
+    msg.u.event.source.len   = 16;
+    msg.u.event.payload.data = (const uint8_t *) "payload";
+    msg.u.event.payload.len  = 7;
+
+    out = buf;
+    len = sizeof(buf);
+    CU_ASSERT_FATAL(WRPE_OK == wrp_to_msgpack(&msg, &out, &len));
+
+    /* Rewrite in place with the same, a shorter and a longer length. */
+    for (size_t i = 1; i < 4; i++) {
+        out_len = sizeof(buf);
+        CU_ASSERT_FATAL(WRPE_OK
+                        == wrp_rewrite_field(buf, len, WRP_FIELD__DEST, dests[i],
+                                             strlen(dests[i]), &out, &out_len));
+        CU_ASSERT(buf == out);
+        len = out_len;
+
+        CU_ASSERT_FATAL(WRPE_OK == wrp_from_msgpack(buf, len, &got));
+        CU_ASSERT(strlen(dests[i]) == got->u.event.dest.len);
+        CU_ASSERT(0 == memcmp(dests[i], got->u.event.dest.s,
+                              got->u.event.dest.len));
+        CU_ASSERT(7 == got->u.event.payload.len);
+        CU_ASSERT(0 == memcmp("payload", got->u.event.payload.data, 7));
+        wrp_destroy(got);
+    }
+
+    out_len = 10;
+    CU_ASSERT(WRPE_MSG_TOO_BIG
+              == wrp_rewrite_field(buf, len, WRP_FIELD__SOURCE, "x", 1,
+                                   &out, &out_len));
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_rewrite_field(NULL, len, WRP_FIELD__DEST, "x", 1,
+                                   &out, &out_len));
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_rewrite_field(buf, len, WRP_FIELD__DEST, NULL, 1,
+                                   &out, &out_len));
+
+    /* Missing, not a string and not a map. */
+    out = NULL;
+    CU_ASSERT(WRPE_NOT_A_WRP_MSG
+              == wrp_rewrite_field(buf, len, WRP_FIELD__MSG_ID, "x", 1,
+                                   &out, &out_len));
+    CU_ASSERT(WRPE_NOT_A_WRP_MSG
+              == wrp_rewrite_field(buf, len, WRP_FIELD__PAYLOAD, "x", 1,
+                                   &out, &out_len));
+    CU_ASSERT(WRPE_NOT_A_WRP_MSG
+              == wrp_rewrite_field(not_a_map, sizeof(not_a_map),
+                                   WRP_FIELD__DEST, "x", 1, &out, &out_len));
+    CU_ASSERT(WRPE_NOT_MSGPACK_FORMAT
+              == wrp_rewrite_field(buf, len - 1, WRP_FIELD__SESSION_ID,
+                                   "x", 1, &out, &out_len));
+    CU_ASSERT(NULL == out);
+}
+
+void test_09(void)
+{
+    struct wrp_nvp one[3] = {
+        { { 1, "b" }, { 1, "2" } },
+        { { 1, "a" }, { 1, "1" } },
+        { { 2, "ab" }, { 1, "3" } },
+    };
+    struct wrp_nvp two[3] = { one[2], one[0], one[1] };
+    uint8_t *a = NULL;
+    uint8_t *b = NULL;
+    uint8_t *c = NULL;
+    size_t a_len;
+    size_t b_len;
+    size_t c_len;
+    wrp_msg_t msg;
+
+    memset(&msg, 0, sizeof(wrp_msg_t));
+    msg.msg_type               = WRP_MSG_TYPE__EVENT;
+    msg.u.event.dest.s         = "event:x";
+    msg.u.event.dest.len       = 7;
+    msg.u.event.source.s       = "mac:112233445566";
+    msg.u.event.source.len     = 16;
+    msg.u.event.metadata.list  = one;
+    msg.u.event.metadata.count = 3;
+
+    CU_ASSERT(WRPE_INVALID_ARGS == wrp_to_msgpack_canonical(NULL, &a, &a_len));
+    CU_ASSERT_FATAL(WRPE_OK == wrp_to_msgpack_canonical(&msg, &a, &a_len));
+
+    msg.u.event.metadata.list = two;
+    CU_ASSERT_FATAL(WRPE_OK == wrp_to_msgpack_canonical(&msg, &b, &b_len));
+    CU_ASSERT_FATAL(a_len == b_len);
+    CU_ASSERT(0 == memcmp(a, b, a_len));
+
+    /* Already in order it is the same as the normal encoding. */
+    two[0] = one[1];
+    two[1] = one[2];
+    two[2] = one[0];
+    CU_ASSERT_FATAL(WRPE_OK == wrp_to_msgpack(&msg, &c, &c_len));
+    CU_ASSERT_FATAL(a_len == c_len);
+    CU_ASSERT(0 == memcmp(a, c, a_len));
+
+    /* The caller's list is left alone. */
+    CU_ASSERT(0 == memcmp(&one[0], &two[2], sizeof(struct wrp_nvp)));
+
+    free(a);
+    free(b);
+    free(c);
+}
+
+void test_10(void)
+{
+    const char *b64  = "{\"msg_type\":4,\"dest\":\"event:\\\"x\\\"\","
+                       "\"source\":\"mac:112233445566\","
+                       "\"content_type\":\"a\\\\b\\n\\u0001\","
+                       "\"headers\":[\"h:1\",\"h:2\"],"
+                       "\"metadata\":{\"k\":\"v\"},"
+                       "\"payload\":\"aGVsbG8=\"}";
+    const char *utf8 = "{\"msg_type\":4,\"dest\":\"event:\\\"x\\\"\","
+                       "\"source\":\"mac:112233445566\","
+                       "\"content_type\":\"a\\\\b\\n\\u0001\","
+                       "\"headers\":[\"h:1\",\"h:2\"],"
+                       "\"metadata\":{\"k\":\"v\"},"
+                       "\"payload\":\"hello\"}";
+    struct wrp_string headers[2] = { { 3, "h:1" }, { 3, "h:2" } };
+    struct wrp_nvp nvp           = { { 1, "k" }, { 1, "v" } };
+    struct collected c           = { NULL, 0 };
+    char stage[32];
+    char buf[512];
+    int calls = 0;
+    size_t len;
+    wrp_msg_t msg;
+
+    memset(&msg, 0, sizeof(wrp_msg_t));
+    msg.msg_type                 = WRP_MSG_TYPE__EVENT;
+    msg.u.event.dest.s           = "event:\"x\"";
+    msg.u.event.dest.len         = 9;
+    msg.u.event.source.s         = "mac:112233445566";
+    msg.u.event.source.len       = 16;
+    msg.u.event.content_type.s   = "a\\b\n\x01";
+    msg.u.event.content_type.len = 5;
+    msg.u.event.headers.list     = headers;
+    msg.u.event.headers.count    = 2;
+    msg.u.event.metadata.list    = &nvp;
+    msg.u.event.metadata.count   = 1;
+    msg.u.event.payload.data     = (const uint8_t *) "hello";
+    msg.u.event.payload.len      = 5;
+
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_to_json(NULL, WRP_JSON_PAYLOAD__OMIT, buf, sizeof(buf),
+                             &len));
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_to_json(&msg, WRP_JSON_PAYLOAD__OMIT, NULL, 1, &len));
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_to_json(&msg, (enum wrp_json_payload) 9, buf, sizeof(buf),
+                             &len));
+
+    CU_ASSERT(WRPE_OK == wrp_to_json(&msg, WRP_JSON_PAYLOAD__BASE64, buf,
+                                     sizeof(buf), &len));
+    CU_ASSERT(0 == strcmp(b64, buf));
+    CU_ASSERT(strlen(b64) == len);
+
+    CU_ASSERT(WRPE_OK == wrp_to_json(&msg, WRP_JSON_PAYLOAD__UTF8, buf,
+                                     sizeof(buf), &len));
+    CU_ASSERT(0 == strcmp(utf8, buf));
+
+    /* Omitted, or not valid UTF-8, leaves the payload out. */
+    CU_ASSERT(WRPE_OK == wrp_to_json(&msg, WRP_JSON_PAYLOAD__OMIT, buf,
+                                     sizeof(buf), &len));
+    CU_ASSERT(NULL == strstr(buf, "payload"));
+    msg.u.event.payload.data = (const uint8_t *) "\xc0\xaf";
+    msg.u.event.payload.len  = 2;
+    CU_ASSERT(WRPE_OK == wrp_to_json(&msg, WRP_JSON_PAYLOAD__UTF8, buf,
+                                     sizeof(buf), &len));
+    CU_ASSERT(NULL == strstr(buf, "payload"));
+    msg.u.event.payload.data = (const uint8_t *) "\xe2\x82\xac";
+    msg.u.event.payload.len  = 3;
+    CU_ASSERT(WRPE_OK == wrp_to_json(&msg, WRP_JSON_PAYLOAD__UTF8, buf,
+                                     sizeof(buf), &len));
+    CU_ASSERT(NULL != strstr(buf, "\"payload\":\"\xe2\x82\xac\""));
+
+    /* Bytes that aren't valid UTF-8 are replaced in the strings. */
+    msg.u.event.dest.s   = "a\xff\xc3\xa9\xe2\x82";
+    msg.u.event.dest.len = 6;
+    CU_ASSERT(WRPE_OK == wrp_to_json(&msg, WRP_JSON_PAYLOAD__OMIT, buf,
+                                     sizeof(buf), &len));
+    CU_ASSERT(NULL
+              != strstr(buf, "\"dest\":\"a\\ufffd\xc3\xa9\\ufffd\\ufffd\""));
+    msg.u.event.dest.s   = "event:\"x\"";
+    msg.u.event.dest.len = 9;
+
+    /* Cut short, but still terminated. */
+    CU_ASSERT(WRPE_MSG_TOO_BIG
+              == wrp_to_json(&msg, WRP_JSON_PAYLOAD__UTF8, buf, 5, &len));
+    CU_ASSERT(0 == strcmp("{\"ms", buf));
+
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_to_json_flush(&msg, WRP_JSON_PAYLOAD__OMIT, stage, 31,
+                                   collect, &c));
+    CU_ASSERT(WRPE_OK == wrp_to_json(&msg, WRP_JSON_PAYLOAD__UTF8, buf,
+                                     sizeof(buf), &len));
+    CU_ASSERT(WRPE_OK == wrp_to_json_flush(&msg, WRP_JSON_PAYLOAD__UTF8, stage,
+                                           sizeof(stage), collect, &c));
+    CU_ASSERT_FATAL(len == c.len);
+    CU_ASSERT(0 == memcmp(buf, c.buf, len));
+    free(c.buf);
+
+    /* The callback's error stops the output and is returned. */
+    CU_ASSERT(WRPE_NO_SCHEME
+              == wrp_to_json_flush(&msg, WRP_JSON_PAYLOAD__UTF8, stage,
+                                   sizeof(stage), refuse, &calls));
+    CU_ASSERT(1 == calls);
+
+    msg.msg_type = (enum wrp_msg_type) 99;
+    CU_ASSERT(WRPE_NOT_A_WRP_MSG
+              == wrp_to_json(&msg, WRP_JSON_PAYLOAD__OMIT, buf, sizeof(buf),
+                             &len));
+}
+
+void test_11(void)
+{
+    const char *json = " { \"dest\" : \"event:\\u00e9\\ud83d\\ude00\\/x\","
+                       " \"msg_type\": 4,"
+                       " \"extra\": [1, -2.5e3, {\"a\": [true, false]}],"
+                       " \"source\": \"mac:112233445566\", \"session_id\": null,"
+                       " \"headers\": [\"a\", \"b\"],"
+                       " \"metadata\": {\"k\": \"v\", \"n\": null},"
+                       " \"payload\": \"aGVsbG8\" } ";
+    const char *bad[] = {
+        "",
+        "{",
+        "{\"msg_type\": 4,}",
+        "{\"msg_type\": 04}",
+        "{\"msg_type\": 4} x",
+        "{\"dest\": \"\\x\"}",
+        "{\"dest\": \"\\ud83d\"}",
+        "{\"dest\": \"\t\"}",
+        "[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[["
+        "]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]",
+    };
+    const char *wrong[] = {
+        "[]",
+        "{}",
+        "{\"msg_type\": 99}",
+        "{\"msg_type\": 4.5, \"dest\": \"d\", \"source\": \"s\"}",
+        "{\"msg_type\": 4, \"source\": \"s\"}",
+        "{\"msg_type\": 4, \"dest\": 1, \"source\": \"s\"}",
+        "{\"msg_type\": 4, \"dest\": null, \"source\": \"s\"}",
+        "{\"msg_type\": 4, \"dest\": \"d\", \"source\": \"s\","
+        " \"headers\": [1]}",
+        "{\"msg_type\": 4, \"dest\": \"d\", \"source\": \"s\","
+        " \"metadata\": []}",
+        "{\"msg_type\": 4, \"dest\": \"d\", \"source\": \"s\","
+        " \"payload\": \"a\"}",
+        "{\"msg_type\": 4, \"dest\": \"d\", \"dest\": \"d\", \"source\": \"s\"}",
+        "{\"msg_type\": 2, \"status\": 2147483648}",
+    };
+    wrp_msg_t *msg = NULL;
+
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_from_json(NULL, 0, WRP_JSON_PAYLOAD__OMIT, &msg));
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_from_json(json, strlen(json), WRP_JSON_PAYLOAD__OMIT,
+                               NULL));
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_from_json(json, strlen(json), (enum wrp_json_payload) 9,
+                               &msg));
+
+    CU_ASSERT_FATAL(WRPE_OK == wrp_from_json(json, strlen(json),
+                                             WRP_JSON_PAYLOAD__BASE64, &msg));
+    CU_ASSERT(WRP_MSG_TYPE__EVENT == msg->msg_type);
+    CU_ASSERT(14 == msg->u.event.dest.len);
+    CU_ASSERT(0 == memcmp("event:\xc3\xa9\xf0\x9f\x98\x80/x",
+                          msg->u.event.dest.s, 14));
+    CU_ASSERT(0 == msg->u.event.session_id.len);
+    CU_ASSERT(2 == msg->u.event.headers.count);
+    CU_ASSERT(0 == memcmp("b", msg->u.event.headers.list[1].s, 1));
+    CU_ASSERT_FATAL(2 == msg->u.event.metadata.count);
+    CU_ASSERT(0 == memcmp("v", msg->u.event.metadata.list[0].value.s, 1));
+    CU_ASSERT(0 == msg->u.event.metadata.list[1].value.len);
+    CU_ASSERT(5 == msg->u.event.payload.len);
+    CU_ASSERT(0 == memcmp("hello", msg->u.event.payload.data, 5));
+    CU_ASSERT(WRPE_OK == wrp_destroy(msg));
+
+    CU_ASSERT_FATAL(WRPE_OK == wrp_from_json(json, strlen(json),
+                                             WRP_JSON_PAYLOAD__UTF8, &msg));
+    CU_ASSERT(7 == msg->u.event.payload.len);
+    CU_ASSERT(0 == memcmp("aGVsbG8", msg->u.event.payload.data, 7));
+    CU_ASSERT(WRPE_OK == wrp_destroy(msg));
+
+    CU_ASSERT_FATAL(WRPE_OK == wrp_from_json(json, strlen(json),
+                                             WRP_JSON_PAYLOAD__OMIT, &msg));
+    CU_ASSERT(0 == msg->u.event.payload.len);
+    CU_ASSERT(WRPE_OK == wrp_destroy(msg));
+
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        msg = NULL;
+        CU_ASSERT(WRPE_NOT_JSON_FORMAT
+                  == wrp_from_json(bad[i], strlen(bad[i]),
+                                   WRP_JSON_PAYLOAD__BASE64, &msg));
+        CU_ASSERT(NULL == msg);
+    }
+
+    for (size_t i = 0; i < sizeof(wrong) / sizeof(wrong[0]); i++) {
+        msg = NULL;
+        CU_ASSERT(WRPE_NOT_A_WRP_MSG
+                  == wrp_from_json(wrong[i], strlen(wrong[i]),
+                                   WRP_JSON_PAYLOAD__BASE64, &msg));
+        CU_ASSERT(NULL == msg);
+    }
+}
+
+struct logged {
+    int filtered;
+    int calls;
+    enum wrp_log_level level;
+    char text[4096];
+    size_t len;
+};
+
+static bool only_events(void *ctx, enum wrp_log_level level,
+                        const wrp_msg_t *msg)
+{
+    (void) level;
+
+    ((struct logged *) ctx)->filtered++;
+
+    return (WRP_MSG_TYPE__EVENT == msg->msg_type);
+}
+
+static void keep(void *ctx, enum wrp_log_level level, const char *text,
+                 size_t len)
+{
+    struct logged *l = (struct logged *) ctx;
+
+    CU_ASSERT_FATAL(len < sizeof(l->text));
+    CU_ASSERT('\0' == text[len]);
+    memcpy(l->text, text, len + 1);
+    l->len   = len;
+    l->level = level;
+    l->calls++;
+}
+
+void test_12(void)
+{
+    struct wrp_string headers[40];
+    struct logged got;
+    struct wrp_log log = { WRP_LOG_LEVEL__DEBUG, only_events, keep, &got };
+    char *out          = NULL;
+    size_t len         = 0;
+    wrp_msg_t msg;
+
+    memset(&got, 0, sizeof(got));
+    memset(&msg, 0, sizeof(wrp_msg_t));
+    msg.msg_type           = WRP_MSG_TYPE__EVENT;
+    msg.u.event.dest.s     = "event:x";
+    msg.u.event.dest.len   = 7;
+    msg.u.event.source.s   = "mac:112233445566";
+    msg.u.event.source.len = 16;
+
+    CU_ASSERT(WRPE_INVALID_ARGS
+              == wrp_log_msg(&log, WRP_LOG_LEVEL__ERROR, NULL));
+    CU_ASSERT(false == wrp_log_enabled(NULL, WRP_LOG_LEVEL__ERROR));
+    CU_ASSERT(WRPE_OK == wrp_log_msg(NULL, WRP_LOG_LEVEL__ERROR, &msg));
+    CU_ASSERT(true == wrp_log_enabled(&log, WRP_LOG_LEVEL__DEBUG));
+    CU_ASSERT(false == wrp_log_enabled(&log, WRP_LOG_LEVEL__TRACE));
+
+    /* Too verbose, so the filter isn't even asked. */
+    CU_ASSERT(WRPE_OK == wrp_log_msg(&log, WRP_LOG_LEVEL__TRACE, &msg));
+    CU_ASSERT(0 == got.filtered);
+    CU_ASSERT(0 == got.calls);
+
+    CU_ASSERT(WRPE_OK == wrp_log_msg(&log, WRP_LOG_LEVEL__INFO, &msg));
+    CU_ASSERT(1 == got.filtered);
+    CU_ASSERT(1 == got.calls);
+    CU_ASSERT(WRP_LOG_LEVEL__INFO == got.level);
+    CU_ASSERT_FATAL(WRPE_OK == wrp_to_string(&msg, &out, &len));
+    CU_ASSERT(len == got.len);
+    CU_ASSERT(0 == strcmp(out, got.text));
+    free(out);
+
+    /* Bigger than the buffer so far, which grows to fit. */
+    for (size_t i = 0; i < 40; i++) {
+        headers[i].s   = "X-Some-Header: some value for the header";
+        headers[i].len = strlen(headers[i].s);
+    }
+    msg.u.event.headers.list  = headers;
+    msg.u.event.headers.count = 40;
+    CU_ASSERT(WRPE_OK == wrp_log_msg(&log, WRP_LOG_LEVEL__DEBUG, &msg));
+    CU_ASSERT(2 == got.calls);
+    CU_ASSERT_FATAL(WRPE_OK == wrp_to_string(&msg, &out, &len));
+    CU_ASSERT(1024 < len);
+    CU_ASSERT(len == got.len);
+    CU_ASSERT(0 == strcmp(out, got.text));
+    free(out);
+
+    /* The filter drops it. */
+    msg.msg_type = WRP_MSG_TYPE__SVC_ALIVE;
+    CU_ASSERT(WRPE_OK == wrp_log_msg(&log, WRP_LOG_LEVEL__ERROR, &msg));
+    CU_ASSERT(3 == got.filtered);
+    CU_ASSERT(2 == got.calls);
+
+    /* Without a filter the level is all that matters. */
+    log.filter = NULL;
+    CU_ASSERT(WRPE_OK == wrp_log_msg(&log, WRP_LOG_LEVEL__ERROR, &msg));
+    CU_ASSERT(3 == got.calls);
+}
+
 void add_suites(CU_pSuite *suite)
 {
     *suite = CU_add_suite("misc tests", NULL, NULL);
     CU_add_test(*suite, "test_01", test_01);
     CU_add_test(*suite, "test_02", test_02);
     CU_add_test(*suite, "test_03", test_03);
+    CU_add_test(*suite, "test_04", test_04);
+    CU_add_test(*suite, "test_05", test_05);
+    CU_add_test(*suite, "test_06", test_06);
+    CU_add_test(*suite, "test_07", test_07);
+    CU_add_test(*suite, "test_08", test_08);
+    CU_add_test(*suite, "test_09", test_09);
+    CU_add_test(*suite, "test_10", test_10);
+    CU_add_test(*suite, "test_11", test_11);
+    CU_add_test(*suite, "test_12", test_12);
 }
 
 